@@ -0,0 +1,234 @@
+// Микробенчмарки EgLang на хосте: циклов в секунду, нс на правило
+// за цикл и время разбора для каждого типа правил при 1..MAX_RULES правилах
+
+#include <EgLang.h>
+#include "EgHostHal.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const byte kInputs[] = { EGLANG_INPUT_PINS };
+static const byte kOutputs[] = { EGLANG_OUTPUT_PINS };
+static const int kSizes[] = { 1, 2, 5, 10, 15, MAX_RULES };
+
+typedef void (*RuleMaker)(char* buf, size_t size, int i);
+
+static byte in(int i) { return kInputs[i % INPUT_COUNT]; }
+static byte out(int i) { return kOutputs[i % OUTPUT_COUNT]; }
+
+static void makeSimple(char* buf, size_t size, int i) {
+    snprintf(buf, size, "%d,%d", out(i), i & 1);
+}
+
+static void makeConditional(char* buf, size_t size, int i) {
+    snprintf(buf, size, "?%d,%d!%d,1", in(i), (i >> 1) & 1, out(i));
+}
+
+static void makeAnd(char* buf, size_t size, int i) {
+    snprintf(buf, size, "?%d,0&%d,1!%d,1", in(i), in(i + 1), out(i));
+}
+
+static void makeExpr(char* buf, size_t size, int i) {
+    snprintf(buf, size, "?(%d,0|%d,1)&~%d,1!%d,1", in(i), in(i + 1), in(i + 2), out(i));
+}
+
+static void makeLoop(char* buf, size_t size, int i) {
+    snprintf(buf, size, "[%d:%d,1;%d,0]", in(i), out(i), out(i));
+}
+
+static void makeSequence(char* buf, size_t size, int i) {
+    snprintf(buf, size, "[%d:%d,1@20;%d,0@30]", in(i), out(i), out(i));
+}
+
+static void makeTimer(char* buf, size_t size, int i) {
+    static const char marks[] = { '+', '-', '*' };
+    snprintf(buf, size, "?%d,1%c%d!%d,1", in(i), marks[i % 3], 20 + i, out(i));
+}
+
+static void makeMixed(char* buf, size_t size, int i) {
+    static const RuleMaker makers[] = { makeSimple, makeConditional, makeAnd, makeExpr, makeLoop };
+    makers[i % 5](buf, size, i / 5);
+}
+
+struct RuleKind {
+    const char* name;
+    RuleMaker make;
+    bool combinational;              // Можно собрать в таблицу LUT
+};
+
+static const RuleKind kKinds[] = {
+    { "simple",      makeSimple,      false },
+    { "conditional", makeConditional, true  },
+    { "and",         makeAnd,         true  },
+    { "expr",        makeExpr,        true  },
+    { "loop",        makeLoop,        false },
+    { "sequence",    makeSequence,    false },
+    { "timer",       makeTimer,       false },
+    { "mixed",       makeMixed,       false },
+};
+
+// Одни и те же правила текстом для add() и скомпилированные RF() для addProgram()
+// на пинах профиля платы
+#if EGLANG_BOARD == EGLANG_BOARD_MEGA
+#define EGLANG_BENCH_RULES(X) \
+    X("2,1") X("?22,0!4,1") X("?23,1&24,0!6,1") X("[25:8,1;8,0]") \
+    X("?26,0!10,1") X("?27,0&22,1!12,1") X("[24:2,0;4,1]") X("12,0") \
+    X("?(22,0|23,1)&~24,1!2,1")
+#elif EGLANG_BOARD == EGLANG_BOARD_ESP32
+#define EGLANG_BENCH_RULES(X) \
+    X("4,1") X("?13,0!5,1") X("?14,1&16,0!23,1") X("[17:25,1;25,0]") \
+    X("?18,0!26,1") X("?19,0&13,1!27,1") X("[16:4,0;5,1]") X("27,0") \
+    X("?(13,0|14,1)&~16,1!4,1")
+#else
+#define EGLANG_BENCH_RULES(X) \
+    X("2,1") X("?3,0!4,1") X("?5,1&7,0!6,1") X("[9:8,1;8,0]") \
+    X("?11,0!10,1") X("?13,0&3,1!12,1") X("[7:2,0;4,1]") X("12,0") \
+    X("?(3,0|5,1)&~7,1!2,1")
+#endif
+
+#define EGLANG_BENCH_TEXT(rule) rule,
+static const char* const kProgramText[] = { EGLANG_BENCH_RULES(EGLANG_BENCH_TEXT) };
+constexpr RuleImage kProgram[] PROGMEM = { EGLANG_BENCH_RULES(RF) };
+static const int kProgramSize = sizeof(kProgram) / sizeof(kProgram[0]);
+
+static unsigned long long nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static unsigned long rng = 0x2545F491;
+
+static unsigned long nextRandom() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Новый контроллер и плата, правила kind в количестве n;
+// false - правила не помещаются в арену
+static bool setup(const RuleKind& kind, int n) {
+    EgHostHal::reset();
+    EgHostHal::setRecording(false);
+    _eglang = EgLangController();
+    _eglang.init();
+    
+    char text[MAX_RULE_LENGTH];
+    for (int i = 0; i < n; i++) {
+        kind.make(text, sizeof(text), i);
+        RuleImage image;
+        if (!image.parse(text)) {
+            fprintf(stderr, "rule rejected: %s\n", text);
+            exit(1);
+        }
+        if (!_eglang.add(text)) return false;
+    }
+    return true;
+}
+
+// Время разбора: нс на один add(); -1 - правила не помещаются в арену
+static double benchParse(const RuleKind& kind, int n, int repeats) {
+    char texts[MAX_RULES][MAX_RULE_LENGTH];
+    for (int i = 0; i < n; i++) kind.make(texts[i], sizeof(texts[i]), i);
+    
+    unsigned long long total = 0;
+    for (int r = 0; r < repeats; r++) {
+        EgHostHal::reset();
+        _eglang = EgLangController();
+        _eglang.init();
+        
+        int added = 0;
+        unsigned long long start = nowNs();
+        for (int i = 0; i < n; i++) added += _eglang.add(texts[i]);
+        total += nowNs() - start;
+        if (added < n) return -1;
+    }
+    return (double)total / ((double)repeats * n);
+}
+
+// Время цикла: togglePeriod - раз в сколько циклов меняется случайный вход (0 - входы неподвижны)
+static double benchScan(int scans, int togglePeriod) {
+    unsigned long long start = nowNs();
+    for (int s = 0; s < scans; s++) {
+        if (togglePeriod && s % togglePeriod == 0) {
+            byte pin = kInputs[nextRandom() % INPUT_COUNT];
+            EgHostHal::setInput(pin, !EgHostHal::level(pin));
+        }
+        EgHostHal::advance(1000);
+        _eglang.run();
+    }
+    return (double)(nowNs() - start) / scans;
+}
+
+int main(int argc, char** argv) {
+    int scans = (argc > 1) ? atoi(argv[1]) : 20000;
+    if (scans <= 0) scans = 20000;
+    
+    printf("EgLang host benchmark: %d scans per case, MAX_RULES=%d\n\n", scans, MAX_RULES);
+    
+    printf("%-12s %6s %12s\n", "parse", "rules", "ns/rule");
+    for (const RuleKind& kind : kKinds) {
+        for (int n : kSizes) {
+            double ns = benchParse(kind, n, 2000);
+            if (ns < 0) {
+                printf("%-12s %6d %s\n", kind.name, n, "skipped (arena full)");
+            } else {
+                printf("%-12s %6d %12.1f\n", kind.name, n, ns);
+            }
+        }
+    }
+    
+    printf("\n%-12s %-5s %6s %-6s %12s %12s %12s\n",
+           "scan", "mode", "rules", "inputs", "scans/s", "ns/scan", "ns/rule");
+    for (const RuleKind& kind : kKinds) {
+        for (int n : kSizes) {
+            for (int lut = 0; lut <= (kind.combinational ? 1 : 0); lut++) {
+                for (int busy = 0; busy <= 1; busy++) {
+                    const char* skipped = NULL;
+                    if (!setup(kind, n)) {
+                        skipped = "skipped (arena full)";
+                    } else if (lut && !_eglang.compileLut()) {
+                        skipped = "skipped (no lut)";
+                    }
+                    if (skipped) {
+                        printf("%-12s %-5s %6d %-6s %s\n",
+                               kind.name, lut ? "lut" : "rules", n, busy ? "busy" : "idle", skipped);
+                        continue;
+                    }
+                    
+                    benchScan(scans / 10, busy ? 4 : 0);   // Прогрев
+                    double ns = benchScan(scans, busy ? 4 : 0);
+                    printf("%-12s %-5s %6d %-6s %12.0f %12.1f %12.2f\n",
+                           kind.name, lut ? "lut" : "rules", n, busy ? "busy" : "idle",
+                           1e9 / ns, ns, ns / n);
+                }
+            }
+        }
+    }
+    
+    // Одна программа: разбор текста, образы RF() в PROGMEM и образ из EEPROM
+    static const char* const kBoot[] = { "sram", "flash", "eeprom" };
+    printf("\n%-12s %6s %12s %12s\n", "program", "rules", "boot ns", "ns/scan");
+    for (int boot = 0; boot < 3; boot++) {
+        EgHostHal::reset();
+        EgHostHal::setRecording(false);
+        _eglang = EgLangController();
+        _eglang.init();
+        
+        unsigned long long start = nowNs();
+        if (boot == 1) {
+            _eglang.addProgram(kProgram, kProgramSize);
+        } else if (boot == 2) {
+            _eglang.loadImage();
+        } else {
+            for (int i = 0; i < kProgramSize; i++) _eglang.add(kProgramText[i]);
+        }
+        double ns = (double)(nowNs() - start);
+        if (boot == 0) _eglang.saveImage();
+        
+        benchScan(scans / 10, 4);
+        printf("%-12s %6d %12.0f %12.1f\n", kBoot[boot], (int)_eglang.count, ns, benchScan(scans, 4));
+    }
+    return 0;
+}
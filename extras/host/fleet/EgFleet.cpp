@@ -0,0 +1,134 @@
+#include "EgFleet.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Очередь потока: свои программы берутся с конца, чужие воруются с начала,
+// так владелец и вор почти не встречаются на одном элементе
+struct WorkQueue {
+    std::mutex lock;
+    std::deque<size_t> items;
+    
+    bool popBack(size_t& item) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (items.empty()) return false;
+        item = items.back();
+        items.pop_back();
+        return true;
+    }
+    
+    bool popFront(size_t& item) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (items.empty()) return false;
+        item = items.front();
+        items.pop_front();
+        return true;
+    }
+};
+
+EgFleet::EgFleet(unsigned threads) : workers(threads), stolen(0) {
+    if (!workers) workers = std::thread::hardware_concurrency();
+    if (!workers) workers = 1;
+}
+
+std::vector<EgFleetResult> EgFleet::run(const std::vector<EgFleetProgram>& programs) {
+    std::vector<EgFleetResult> results(programs.size());
+    unsigned n = workers < programs.size() ? workers : (unsigned)programs.size();
+    stolen = 0;
+    if (!n) return results;
+    
+    // Блоки подряд: соседние программы часто похожи по цене, воровство
+    // выравнивает остаток
+    std::vector<WorkQueue> queues(n);
+    for (size_t i = 0; i < programs.size(); i++) {
+        queues[i * n / programs.size()].items.push_back(i);
+    }
+    
+    std::atomic<unsigned long> stealCount(0);
+    std::vector<std::thread> pool;
+    for (unsigned w = 0; w < n; w++) {
+        pool.push_back(std::thread([&, w]() {
+            size_t item;
+            for (;;) {
+                if (!queues[w].popBack(item)) {
+                    // Новых программ не появляется: все очереди пусты - конец
+                    bool found = false;
+                    for (unsigned k = 1; k < n && !found; k++) {
+                        found = queues[(w + k) % n].popFront(item);
+                    }
+                    if (!found) return;
+                    stealCount++;
+                }
+                results[item] = simulate(programs[item]);
+            }
+        }));
+    }
+    for (size_t w = 0; w < pool.size(); w++) pool[w].join();
+    
+    stolen = stealCount;
+    return results;
+}
+
+EgFleetResult EgFleet::simulate(const EgFleetProgram& program) {
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    EgFleetResult result;
+    
+    // Контроллер занимает килобайты - в куче, а не на стеке потока
+    std::unique_ptr<EgHostBoard> board(new EgHostBoard());
+    std::unique_ptr<EgLangController> ctl(new EgLangController);
+    EgHostBoard::Scope scope(*board);
+    
+    ctl->init();
+    ctl->setArbitration(program.arbitration);
+    ctl->setScanPeriod(program.scanMs);
+    result.loaded = true;
+    for (size_t i = 0; i < program.rules.size(); i++) {
+        if (!ctl->add(program.rules[i].c_str())) {
+            result.loaded = false;
+            result.rejected = (int)i;
+            break;
+        }
+    }
+    
+    if (result.loaded) {
+        for (size_t k = 0; k < program.inputs.size(); k++) {
+            board->schedule(program.inputs[k].timeUs, program.inputs[k].pin, program.inputs[k].level);
+        }
+        
+        // Шаг 1 мс: poll() сам решает, пора ли цикл
+        size_t analog = 0;
+        size_t expect = 0;
+        for (unsigned long ms = 0; ms < program.durationMs; ms++) {
+            board->advance(1000);
+            for (; analog < program.analog.size() && program.analog[analog].timeUs <= board->now(); analog++) {
+                board->setAnalog(program.analog[analog].pin, program.analog[analog].value);
+            }
+            ctl->poll();
+            for (; expect < program.expects.size() && program.expects[expect].timeUs <= board->now(); expect++) {
+                // Выход, который правила еще не настроили, - не HIGH подтяжки, а LOW
+                byte pin = program.expects[expect].pin;
+                byte level = board->mode(pin) == OUTPUT ? board->level(pin) : LOW;
+                if (level == program.expects[expect].level) continue;
+                if (!result.failed) result.firstFailed = (int)expect;
+                result.failed++;
+            }
+        }
+        
+        // Ожидания после конца прогона не проверены - тоже провал
+        for (; expect < program.expects.size(); expect++) {
+            if (!result.failed) result.firstFailed = (int)expect;
+            result.failed++;
+        }
+    }
+    
+    result.trace = board->outputs();
+    result.scans = ctl->scans;
+    result.writes = board->writes();
+    result.outputState = ctl->outputState;
+    result.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    return result;
+}
@@ -0,0 +1,79 @@
+#ifndef EGLANG_FLEET_H
+#define EGLANG_FLEET_H
+
+#include <EgLang.h>
+#include "EgHostHal.h"
+
+#include <string>
+#include <vector>
+
+// Парк симуляторов: тысячи независимых контроллеров на пуле потоков.
+// Каждый экземпляр - свой EgLangController на своей плате EgHostBoard,
+// время виртуальное (без ожидания), результат - журнал выходов и счетчики.
+// Программы раздаются потокам блоками, свободный поток ворует работу
+// с другого конца чужой очереди
+
+// Значение analogRead() пина с момента timeUs
+struct EgFleetAnalog {
+    unsigned long timeUs;
+    byte pin;
+    word value;
+};
+
+// Ожидаемый уровень выхода в момент timeUs (после цикла этой миллисекунды);
+// пин, еще не настроенный как OUTPUT, считается LOW
+struct EgFleetExpect {
+    unsigned long timeUs;
+    byte pin;
+    byte level;
+};
+
+// Программа одного экземпляра: правила, настройки и сценарий входов
+struct EgFleetProgram {
+    std::string name;
+    std::vector<std::string> rules;
+    byte arbitration;                // ARB_*
+    unsigned long scanMs;            // Период цикла poll()
+    unsigned long durationMs;        // Длительность прогона в виртуальном времени
+    std::vector<EgHostInputEvent> inputs;
+    std::vector<EgFleetAnalog> analog;   // По времени
+    std::vector<EgFleetExpect> expects;  // По времени
+    
+    EgFleetProgram() : arbitration(ARB_LAST), scanMs(10), durationMs(1000) { }
+};
+
+// Итог экземпляра
+struct EgFleetResult {
+    bool loaded;                     // Все правила приняты
+    int rejected;                    // Номер первого отвергнутого правила или -1
+    std::vector<EgHostOutput> trace; // Журнал выходов платы
+    unsigned long scans;             // Циклов run() через poll()
+    unsigned long writes;            // Записей в пины
+    OutputMask outputState;          // Выходы в конце прогона
+    size_t failed;                   // Невыполненных ожиданий
+    int firstFailed;                 // Номер первого невыполненного или -1
+    double wallMs;                   // Реальное время прогона
+    
+    EgFleetResult() : loaded(false), rejected(-1), scans(0), writes(0), outputState(0),
+                      failed(0), firstFailed(-1), wallMs(0) { }
+};
+
+class EgFleet {
+public:
+    explicit EgFleet(unsigned threads = 0); // 0 - по числу ядер
+    
+    // Все программы; results[i] - итог programs[i]
+    std::vector<EgFleetResult> run(const std::vector<EgFleetProgram>& programs);
+    
+    // Один экземпляр в текущем потоке
+    static EgFleetResult simulate(const EgFleetProgram& program);
+    
+    unsigned threads() const { return workers; }
+    unsigned long steals() const { return stolen; } // Программ, взятых из чужих очередей в последнем run()
+    
+private:
+    unsigned workers;
+    unsigned long stolen;
+};
+
+#endif
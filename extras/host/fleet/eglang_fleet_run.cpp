@@ -0,0 +1,219 @@
+// Пакетная проверка программ правил на парке симуляторов:
+//   eglang_fleet_run [-j потоков] [-n копий] [-o каталог] программа...
+// Каждая программа идет n раз (n независимых экземпляров). С -o журнал
+// выходов каждого экземпляра пишется в каталог/имя.номер.csv, итоги
+// экземпляров - в каталог/summary.csv. Код возврата 1 - есть отвергнутые
+// правила или невыполненные ожидания.
+//
+// Файл программы - строки:
+//   # комментарий
+//   arb last|priority|or|and    политика арбитража (по умолчанию last)
+//   scan мс                     период цикла (по умолчанию 10)
+//   time мс                     длительность прогона (по умолчанию 1000)
+//   at мс пин уровень           вход меняется в момент мс
+//   analog мс пин значение      analogRead() пина с момента мс
+//   expect мс пин уровень       выход должен иметь уровень в момент мс
+//   остальное                   правило, как в add()
+
+#include "EgFleet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char* const kArbitrationNames[] = { "last", "priority", "or", "and" };
+
+static const char* baseName(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+// Строка без пробелов по краям и перевода строки
+static char* trim(char* s) {
+    while (*s == ' ' || *s == '\t') s++;
+    char* end = s + strlen(s);
+    while (end > s && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) end--;
+    *end = '\0';
+    return s;
+}
+
+static bool loadProgram(const char* path, EgFleetProgram& program) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    
+    program.name = baseName(path);
+    char line[256];
+    int number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f)) {
+        number++;
+        char* s = trim(line);
+        if (!*s || *s == '#') continue;
+        
+        char policy[16];
+        unsigned long t, pin, value;
+        if (sscanf(s, "arb %15s", policy) == 1) {
+            int k = 0;
+            while (k < 4 && strcmp(policy, kArbitrationNames[k])) k++;
+            ok = k < 4;
+            program.arbitration = (byte)k;
+        } else if (sscanf(s, "scan %lu", &t) == 1) {
+            program.scanMs = t;
+        } else if (sscanf(s, "time %lu", &t) == 1) {
+            program.durationMs = t;
+        } else if (sscanf(s, "at %lu %lu %lu", &t, &pin, &value) == 3) {
+            EgHostInputEvent e = { t * 1000, (byte)pin, (byte)(value != 0) };
+            program.inputs.push_back(e);
+        } else if (sscanf(s, "analog %lu %lu %lu", &t, &pin, &value) == 3) {
+            EgFleetAnalog e = { t * 1000, (byte)pin, (word)value };
+            program.analog.push_back(e);
+        } else if (sscanf(s, "expect %lu %lu %lu", &t, &pin, &value) == 3) {
+            EgFleetExpect e = { t * 1000, (byte)pin, (byte)(value != 0) };
+            program.expects.push_back(e);
+        } else if (isalpha((unsigned char)*s)) {  // Правила не начинаются с буквы
+            ok = false;
+        } else {
+            program.rules.push_back(s);
+        }
+    }
+    fclose(f);
+    
+    if (!ok) {
+        fprintf(stderr, "%s:%d: bad line\n", path, number);
+        return false;
+    }
+    
+    // Сценарий по времени; равные моменты - в порядке файла
+    std::stable_sort(program.analog.begin(), program.analog.end(),
+        [](const EgFleetAnalog& a, const EgFleetAnalog& b) { return a.timeUs < b.timeUs; });
+    std::stable_sort(program.expects.begin(), program.expects.end(),
+        [](const EgFleetExpect& a, const EgFleetExpect& b) { return a.timeUs < b.timeUs; });
+    return true;
+}
+
+static bool writeTrace(const char* dir, const std::string& name, size_t copy, const EgFleetResult& r) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.%zu.csv", dir, name.c_str(), copy);
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    fprintf(f, "time_us,pin,value\n");
+    for (size_t k = 0; k < r.trace.size(); k++) {
+        fprintf(f, "%lu,%u,%u\n", r.trace[k].timeUs, r.trace[k].pin, r.trace[k].value);
+    }
+    fclose(f);
+    return true;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: eglang_fleet_run [-j threads] [-n copies] [-o dir] program...\n");
+}
+
+int main(int argc, char** argv) {
+    unsigned threads = 0;
+    size_t copies = 1;
+    const char* outDir = NULL;
+    int first = 1;
+    for (; first < argc && argv[first][0] == '-'; first++) {
+        if (first + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        switch (argv[first][1]) {
+            case 'j': threads = (unsigned)atoi(argv[++first]); break;
+            case 'n': copies = (size_t)atol(argv[++first]); break;
+            case 'o': outDir = argv[++first]; break;
+            default: usage(); return 2;
+        }
+    }
+    if (first >= argc || copies == 0) {
+        usage();
+        return 2;
+    }
+    
+    std::vector<EgFleetProgram> sources(argc - first);
+    for (int i = first; i < argc; i++) {
+        if (!loadProgram(argv[i], sources[i - first])) return 2;
+    }
+    
+    // Копии программы подряд: results[p * copies + c]
+    std::vector<EgFleetProgram> programs;
+    programs.reserve(sources.size() * copies);
+    for (size_t p = 0; p < sources.size(); p++) {
+        for (size_t c = 0; c < copies; c++) programs.push_back(sources[p]);
+    }
+    
+    EgFleet fleet(threads);
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    std::vector<EgFleetResult> results = fleet.run(programs);
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    
+    FILE* summary = NULL;
+    if (outDir) {
+        std::string path = std::string(outDir) + "/summary.csv";
+        summary = fopen(path.c_str(), "w");
+        if (!summary) {
+            perror(path.c_str());
+            return 2;
+        }
+        fprintf(summary, "program,copy,loaded,rejected,scans,changes,writes,outputs,failed,wall_ms\n");
+    }
+    
+    printf("%-24s %6s %6s %10s %10s %10s %8s\n", "program", "copies", "bad", "scans", "changes", "outputs", "failed");
+    bool allOk = true;
+    double virtualMs = 0;
+    unsigned long long totalScans = 0;
+    for (size_t p = 0; p < sources.size(); p++) {
+        size_t bad = 0, failed = 0;
+        unsigned long long scans = 0, changes = 0;
+        bool sameOutputs = true;
+        for (size_t c = 0; c < copies; c++) {
+            const EgFleetResult& r = results[p * copies + c];
+            if (!r.loaded) bad++;
+            if (r.failed) failed++;
+            scans += r.scans;
+            changes += r.trace.size();
+            if (r.outputState != results[p * copies].outputState) sameOutputs = false;
+            virtualMs += sources[p].durationMs;
+            
+            if (outDir && !writeTrace(outDir, sources[p].name, c, r)) return 2;
+            if (summary) {
+                fprintf(summary, "%s,%zu,%d,%d,%lu,%zu,%lu,0x%llX,%zu,%.3f\n", sources[p].name.c_str(), c,
+                        r.loaded, r.rejected, r.scans, r.trace.size(), r.writes,
+                        (unsigned long long)r.outputState, r.failed, r.wallMs);
+            }
+        }
+        totalScans += scans;
+        
+        // Экземпляры одной программы детерминированы: разные итоги - ошибка симулятора
+        const EgFleetResult& head = results[p * copies];
+        char outputs[24];
+        if (sameOutputs) {
+            snprintf(outputs, sizeof(outputs), "0x%llX", (unsigned long long)head.outputState);
+        } else {
+            snprintf(outputs, sizeof(outputs), "differ");
+        }
+        printf("%-24s %6zu %6zu %10llu %10llu %10s %8zu\n", sources[p].name.c_str(), copies, bad,
+               scans / copies, changes / copies, outputs, failed);
+        if (!head.loaded) printf("  rule %d rejected: %s\n", head.rejected, sources[p].rules[head.rejected].c_str());
+        if (head.failed) {
+            const EgFleetExpect& e = sources[p].expects[head.firstFailed];
+            printf("  expect %lu ms pin %u = %u failed (%zu of %zu)\n", e.timeUs / 1000, e.pin, e.level,
+                   head.failed, sources[p].expects.size());
+        }
+        if (bad || failed || !sameOutputs) allOk = false;
+    }
+    if (summary) fclose(summary);
+    
+    printf("%zu instances on %u threads (%lu stolen): %.1f ms wall, %llu scans, %.0fx virtual time\n",
+           programs.size(), fleet.threads(), fleet.steals(), wallMs, totalScans,
+           wallMs > 0 ? virtualMs / wallMs : 0.0);
+    return allOk ? 0 : 1;
+}
@@ -0,0 +1,434 @@
+#include "EgRefModel.h"
+
+static const byte kInputPins[] = { EGLANG_INPUT_PINS };
+static const byte kOutputPins[] = { EGLANG_OUTPUT_PINS };
+
+EgRefModel::EgRefModel(byte policy) : arbitration(policy), cursor(0), lastMs(0),
+                                      analogChannels(0), analogPolled(ANALOG_COUNT > 0 ? ANALOG_COUNT - 1 : 0) {
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        levels[i] = HIGH;
+        integrator[i] = 0;
+        stable[i] = false;
+    }
+    memset(analogLevels, 0, sizeof(analogLevels));
+    memset(analogSampled, 0, sizeof(analogSampled));
+    memset(frame, 0, sizeof(frame));
+    memset(board, 0, sizeof(board));
+}
+
+// Число из 1..maxDigits цифр, занимающее весь отрезок, или -1
+int EgRefModel::number(const char* s, const char* end, int maxDigits) {
+    if (s >= end || end - s > maxDigits) return -1;
+    long value = 0;
+    for (; s < end; s++) {
+        if (*s < '0' || *s > '9') return -1;
+        value = value * 10 + (*s - '0');
+    }
+    return (int)value;
+}
+
+int EgRefModel::inputIndex(int pin) {
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        if (kInputPins[i] == pin && pin >= 2) return i;
+    }
+    return -1;
+}
+
+int EgRefModel::outputIndex(int pin) {
+    for (int i = 0; i < OUTPUT_COUNT; i++) {
+        if (kOutputPins[i] == pin && pin >= 2) return i;
+    }
+    return -1;
+}
+
+// Действие "P,0", "P,1", у фронта "P,~", у уровня и простой команды "P,=D"
+bool EgRefModel::parseAction(const char* s, const char* end, bool edge, Rule& r) {
+    const char* comma = (const char*)memchr(s, ',', end - s);
+    if (!comma) return false;
+    int output = outputIndex(number(s, comma, 2));
+    if (output < 0) return false;
+    r.output = (byte)output;
+    
+    const char* v = comma + 1;
+    if (end - v == 1 && (*v == '0' || *v == '1')) {
+        r.duty = (*v == '1') ? 255 : 0;
+        return true;
+    }
+    if (end - v == 1 && *v == '~') {
+        if (!edge) return false;
+        r.kind = TOGGLE;
+        return true;
+    }
+#if EGLANG_ANALOG
+    if (*v == '=' && !edge && (((uint64_t)(EGLANG_PWM_OUTPUTS) >> output) & 1)) {
+        int duty = number(v + 1, end, 5);
+        if (duty < 0 || duty > 255) return false;
+        r.duty = (byte)duty;
+        return true;
+    }
+#endif
+    return false;
+}
+
+bool EgRefModel::parseOr(const char*& s, const char* end, std::vector<Token>& out) {
+    if (!parseAnd(s, end, out)) return false;
+    while (s < end && *s == '|') {
+        s++;
+        if (!parseAnd(s, end, out)) return false;
+        Token t = { '|', 0, 0 };
+        out.push_back(t);
+    }
+    return true;
+}
+
+bool EgRefModel::parseAnd(const char*& s, const char* end, std::vector<Token>& out) {
+    if (!parseUnary(s, end, out)) return false;
+    while (s < end && *s == '&') {
+        s++;
+        if (!parseUnary(s, end, out)) return false;
+        Token t = { '&', 0, 0 };
+        out.push_back(t);
+    }
+    return true;
+}
+
+// "~X", "(X)" или пара "P,S"
+bool EgRefModel::parseUnary(const char*& s, const char* end, std::vector<Token>& out) {
+    if (s >= end) return false;
+    if (*s == '~') {
+        s++;
+        if (!parseUnary(s, end, out)) return false;
+        Token t = { '~', 0, 0 };
+        out.push_back(t);
+        return true;
+    }
+    if (*s == '(') {
+        s++;
+        if (!parseOr(s, end, out) || s >= end || *s != ')') return false;
+        s++;
+        return true;
+    }
+    
+    const char* comma = s;
+    while (comma < end && *comma >= '0' && *comma <= '9') comma++;
+    int input = inputIndex(number(s, comma, 2));
+    if (input < 0 || comma + 1 >= end || *comma != ',' || (comma[1] != '0' && comma[1] != '1')) return false;
+    Token t = { '1', (byte)input, (byte)(comma[1] - '0') };
+    out.push_back(t);
+    s = comma + 2;
+    return true;
+}
+
+// Выражение по входам или "An>порог" / "An<порог"
+bool EgRefModel::parseCondition(const char* s, const char* end, Rule& r) {
+    if (*s == 'A') {
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+        if (end - s < 4) return false;
+        int channel = number(s + 1, s + 2, 1);
+        int threshold = number(s + 3, end, 5);
+        if (channel < 0 || channel >= ANALOG_COUNT || threshold < 0 || threshold > 0xFFFF) return false;
+        if (s[2] != '<' && s[2] != '>') return false;
+        r.channel = channel;
+        r.below = (s[2] == '<');
+        r.threshold = (word)threshold;
+        return true;
+#else
+        return false;
+#endif
+    }
+    return parseOr(s, end, r.condition) && s == end;
+}
+
+// "[P:P,S;P,S]" - цикл, с "@мс" хотя бы у одной команды - последовательность
+bool EgRefModel::parseLoop(const char* s, const char* end, Rule& r) {
+    const char* colon = (const char*)memchr(s, ':', end - s);
+    if (!colon) return false;
+    int input = inputIndex(number(s, colon, 2));
+    if (input < 0) return false;
+    r.input = (byte)input;
+    r.kind = memchr(colon, '@', end - colon) ? SEQUENCE : LOOP;
+    
+    for (const char* c = colon + 1; c <= end; ) {
+        if (c == end && !r.commands.empty()) break;  // ';' в конце списка
+        const char* stop = (const char*)memchr(c, ';', end - c);
+        if (!stop) stop = end;
+        const char* at = (const char*)memchr(c, '@', stop - c);
+        const char* comma = (const char*)memchr(c, ',', stop - c);
+        const char* value = at ? at : stop;
+        if (!comma || value - comma != 2 || (comma[1] != '0' && comma[1] != '1')) return false;
+        
+        int output = outputIndex(number(c, comma, 2));
+        int ms = at ? number(at + 1, stop, 5) : 0;
+        if (output < 0 || ms < 0 || ms > 0xFFFF) return false;
+        Command cmd = { (byte)output, (byte)(comma[1] - '0'), (word)ms };
+        r.commands.push_back(cmd);
+        c = stop + 1;
+    }
+    return true;
+}
+
+bool EgRefModel::add(const char* text) {
+    Rule r = Rule();
+    r.channel = -1;
+    r.pending = true;
+    const char* end = text + strlen(text);
+    if (end - text < 3) return false;
+    
+    bool ok;
+    if (text[0] == '[' && end[-1] == ']') {
+        ok = parseLoop(text + 1, end - 1, r);
+    } else if (text[0] == '?' || text[0] == '^') {
+        const char* bang = strchr(text, '!');
+        if (!bang) return false;
+        
+        bool edge = (text[0] == '^');
+        r.kind = edge ? EDGE : LEVEL;
+        const char* condEnd = bang;
+        const char* mark = edge ? NULL : strpbrk(text + 1, "+-*");
+        if (mark && mark < bang) {
+            int ms = number(mark + 1, bang, 5);
+            if (ms < 0 || ms > 0xFFFF) return false;
+            r.kind = (*mark == '+') ? TON : (*mark == '-') ? TOF : PULSE;
+            r.ms = (word)ms;
+            condEnd = mark;
+        }
+        // ШИМ - только у правила уровня
+        if (r.kind != LEVEL && strchr(bang, '=')) return false;
+        ok = parseAction(bang + 1, end, edge, r) && parseCondition(text + 1, condEnd, r);
+    } else {
+        r.kind = SIMPLE;
+        ok = parseAction(text, end, false, r);
+    }
+    if (!ok) return false;
+    
+    if (r.channel >= 0) analogChannels |= (byte)(1 << r.channel);
+    
+    // Фронт отсчитывается от состояния при загрузке
+    if (r.kind == EDGE || r.kind == TOGGLE) r.met = evaluate(r);
+    rules.push_back(r);
+    return true;
+}
+
+void EgRefModel::setInput(byte pin, byte level) {
+    int i = inputIndex(pin);
+    if (i >= 0) levels[i] = level ? HIGH : LOW;
+}
+
+void EgRefModel::setAnalog(byte channel, word value) {
+    if (channel < 8) analogLevels[channel] = value;
+}
+
+// Антидребезг: интегратор входа идет к окну при LOW и к нулю при HIGH на
+// прошедшее время, но не больше половины окна за выборку; стабильное
+// состояние меняется на краях. Аналоговые каналы - по одному за цикл, по кругу
+void EgRefModel::sample(unsigned long ms) {
+    unsigned long elapsed = ms - lastMs;
+    lastMs = ms;
+    unsigned long step = (EGLANG_DEBOUNCE_MS + 1) / 2;
+    if (elapsed < step) step = elapsed;
+    
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        bool low = (levels[i] == LOW);
+        if (EGLANG_DEBOUNCE_MS == 0) {
+            stable[i] = low;
+            continue;
+        }
+        int level = integrator[i] + (low ? (int)step : -(int)step);
+        if (level < 0) level = 0;
+        if (level > EGLANG_DEBOUNCE_MS) level = EGLANG_DEBOUNCE_MS;
+        integrator[i] = (byte)level;
+        if (level == EGLANG_DEBOUNCE_MS) stable[i] = true;
+        if (level == 0) stable[i] = false;
+    }
+
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+    if (analogChannels) {
+        do {
+            analogPolled = (analogPolled + 1) % ANALOG_COUNT;
+        } while (!((analogChannels >> analogPolled) & 1));
+        analogSampled[analogPolled] = analogLevels[analogPolled];
+    }
+#endif
+}
+
+// Условие по снимку входов или по последней выборке канала с гистерезисом
+// (состояние - результат прошлой проверки)
+bool EgRefModel::evaluate(const Rule& r) const {
+    if (r.channel >= 0) {
+        unsigned long value = analogSampled[r.channel];
+        unsigned long h = EGLANG_ANALOG_HYSTERESIS;
+        if (r.below) return r.met ? value <= r.threshold + h : value < r.threshold;
+        return r.met ? value + h >= r.threshold : value > r.threshold;
+    }
+    
+    bool stack[MAX_RULE_LENGTH];
+    int top = 0;
+    for (size_t k = 0; k < r.condition.size(); k++) {
+        const Token& t = r.condition[k];
+        switch (t.op) {
+            case '1': stack[top++] = (stable[t.input] == (t.state != 0)); break;
+            case '~': stack[top - 1] = !stack[top - 1]; break;
+            case '&': top--; stack[top - 1] = stack[top - 1] && stack[top]; break;
+            default:  top--; stack[top - 1] = stack[top - 1] || stack[top]; break;
+        }
+    }
+    return stack[0];
+}
+
+// Запись в кадр: первая задает выход, следующие сводятся по политике.
+// Цифровое состояние - скважность 0 или 255
+void EgRefModel::request(byte output, byte duty) {
+    Pin& p = frame[output];
+    if (p.driven) {
+        switch (arbitration) {
+            case ARB_PRIORITY: duty = p.duty; break;
+            case ARB_OR:       if (p.duty > duty) duty = p.duty; break;
+            case ARB_AND:      if (p.duty < duty) duty = p.duty; break;
+        }
+    }
+    p.driven = true;
+    p.duty = duty;
+}
+
+void EgRefModel::setTimer(Rule& r, bool q) {
+    if (r.q == q) return;
+    r.q = q;
+    request(r.output, (q == (r.duty != 0)) ? 255 : 0);
+}
+
+// Записи правила за цикл. Правило уровня задает выход, пока выполнено
+// условие; цикл, пока вход нажат, - все свои команды, последовательность -
+// команду текущего шага; остальные пишут только в момент события
+void EgRefModel::check(Rule& r, unsigned long ms) {
+    if (r.kind == LEVEL) {
+        r.met = evaluate(r);
+        if (r.met) request(r.output, r.duty);
+        return;
+    }
+    
+    if (r.kind == SIMPLE) {
+        if (r.pending) request(r.output, r.duty);
+        r.pending = false;
+        return;
+    }
+    
+    if (r.kind == LOOP || r.kind == SEQUENCE) {
+        bool pressed = stable[r.input];
+        if (!r.inLoop) {
+            if (!pressed) return;
+            r.inLoop = true;
+            r.step = 0;
+            r.stepStart = ms;
+        } else if (pressed) {
+            // Шаг за цикл: следующий отсчитывается от конца текущего,
+            // при отставании больше чем на шаг - от текущего момента
+            if (r.kind == SEQUENCE && ms - r.stepStart >= r.commands[r.step].ms) {
+                r.stepStart += r.commands[r.step].ms;
+                r.step = (r.step + 1) % r.commands.size();
+                if (ms - r.stepStart >= r.commands[r.step].ms) r.stepStart = ms;
+            }
+        } else {
+            r.inLoop = false;
+            for (size_t k = 0; k < r.commands.size(); k++) request(r.commands[k].output, 0);
+            return;
+        }
+        
+        if (r.kind == SEQUENCE) {
+            request(r.commands[r.step].output, r.commands[r.step].state ? 255 : 0);
+        } else {
+            for (size_t k = 0; k < r.commands.size(); k++) request(r.commands[k].output, r.commands[k].state ? 255 : 0);
+        }
+        return;
+    }
+    
+    bool met = evaluate(r);
+    bool rising = met && !r.met;
+    bool falling = !met && r.met;
+    r.met = met;
+    
+    switch (r.kind) {
+        case EDGE:
+            if (rising) request(r.output, r.duty);
+            return;
+        case TOGGLE:
+            // Обратное тому, что записано на плате
+            if (rising) request(r.output, (board[r.output].driven && board[r.output].duty) ? 0 : 255);
+            return;
+        case TON:
+            if (rising) {
+                r.running = true;
+                r.started = ms;
+            }
+            if (falling) {
+                r.running = false;
+                setTimer(r, false);
+            }
+            break;
+        case TOF:
+            if (rising) {
+                r.running = false;
+                setTimer(r, true);
+            }
+            if (falling) {
+                r.running = true;
+                r.started = ms;
+            }
+            break;
+        default:
+            if (rising && !r.q) {
+                setTimer(r, true);
+                r.running = true;
+                r.started = ms;
+            }
+            break;
+    }
+    if (r.running && ms - r.started >= r.ms) {
+        r.running = false;
+        setTimer(r, r.kind == TON);
+    }
+}
+
+// Запись кадра на плату: только то, что меняет пин
+void EgRefModel::commit(unsigned long timeUs) {
+    for (byte i = 0; i < OUTPUT_COUNT; i++) {
+        Pin& f = frame[i];
+        Pin& b = board[i];
+        if (!f.driven) continue;
+        
+        bool pwm = f.duty != 0 && f.duty != 255;
+        bool wasPwm = b.driven && b.duty != 0 && b.duty != 255;
+        if (b.driven && b.duty == f.duty && (pwm || !wasPwm)) continue;
+        
+        EgHostOutput e = { timeUs, kOutputPins[i], pwm ? f.duty : (byte)(f.duty != 0) };
+        log.push_back(e);
+        b = f;
+    }
+}
+
+void EgRefModel::scan(unsigned long timeUs) {
+    if (rules.empty()) return;
+    unsigned long ms = timeUs / 1000;
+    sample(ms);
+    memset(frame, 0, sizeof(frame));
+    
+    // Все правила по порядку add(); выход правила уровня с HIGH или ШИМ,
+    // который за цикл никто не задал, отпускается в LOW
+    bool release[OUTPUT_COUNT] = { false };
+    for (size_t i = 0; i < rules.size(); i++) {
+        check(rules[i], ms);
+        if (rules[i].kind == LEVEL && rules[i].duty) release[rules[i].output] = true;
+    }
+    for (byte o = 0; o < OUTPUT_COUNT; o++) {
+        if (release[o] && !frame[o].driven) request(o, 0);
+    }
+    commit(timeUs);
+    
+    // Простые команды идут по курсору и останавливаются на первом правиле
+    // другого вида; после последнего правила все выполняются снова
+    if (cursor < rules.size() && rules[cursor].kind == SIMPLE && !rules[cursor].pending) {
+        if (++cursor >= rules.size()) {
+            cursor = 0;
+            for (size_t i = 0; i < rules.size(); i++) rules[i].pending = true;
+        }
+    }
+}
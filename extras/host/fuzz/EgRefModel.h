@@ -0,0 +1,110 @@
+#ifndef EGLANG_REF_MODEL_H
+#define EGLANG_REF_MODEL_H
+
+#include <EgLang.h>
+#include "EgHostHal.h"
+
+#include <vector>
+
+// Эталонная модель языка для eglang_diff: отдельный простой интерпретатор
+// текста правил. Кода библиотеки не использует - ни parse() и термов, ни
+// владельцев выходов и resolveOutput(), ни колеса таймеров; из EgLang.h
+// берутся только настройки профиля (пины, окно антидребезга, гистерезис).
+// Каждый цикл проверяет все правила по порядку: условия - прямым вычислением
+// выражения по снимку входов, таймеры - по миллисекундам, записи в выходы -
+// по политике арбитража. Время - от init() контроллера, в микросекундах
+class EgRefModel {
+public:
+    explicit EgRefModel(byte arbitration);
+    
+    bool add(const char* text);              // false - модель не принимает правило
+    void setInput(byte pin, byte level);     // Уровень на входе, HIGH - отпущен
+    void setAnalog(byte channel, word value); // Значение analogRead() канала An
+    void scan(unsigned long timeUs);         // Один цикл run() в момент timeUs
+    
+    // Записи в выходы: digitalWrite() - 0/1, analogWrite() - скважность
+    const std::vector<EgHostOutput>& outputs() const { return log; }
+
+private:
+    enum Kind : byte { SIMPLE, LEVEL, EDGE, TOGGLE, TON, TOF, PULSE, LOOP, SEQUENCE };
+    
+    // Выражение условия в обратной польской записи: '1' - вход активен
+    // (стабильно в LOW) и state = 1 или не активен и state = 0; '~', '&', '|'
+    struct Token {
+        char op;
+        byte input;
+        byte state;
+    };
+    
+    // Команда цикла или шаг последовательности
+    struct Command {
+        byte output;
+        byte state;
+        word ms;
+    };
+    
+    struct Rule {
+        Kind kind;
+        byte output;                 // Индекс выхода действия
+        byte duty;                   // 0 и 255 - LOW и HIGH, остальное - ШИМ
+        word ms;                     // Длительность таймера
+        std::vector<Token> condition;
+        int channel;                 // Аналоговое условие: канал или -1
+        bool below;
+        word threshold;
+        byte input;                  // Вход цикла
+        std::vector<Command> commands;
+        
+        bool met;                    // Условие в прошлой проверке
+        bool pending;                // Простая команда ждет выполнения
+        bool q;                      // Выход таймера
+        bool running;
+        unsigned long started;       // Начало отсчета таймера, мс
+        bool inLoop;
+        size_t step;
+        unsigned long stepStart;     // Начало шага, мс
+    };
+    
+    // Выход в кадре цикла или на плате
+    struct Pin {
+        bool driven;
+        byte duty;
+    };
+    
+    bool parseAction(const char* s, const char* end, bool edge, Rule& r);
+    bool parseCondition(const char* s, const char* end, Rule& r);
+    bool parseOr(const char*& s, const char* end, std::vector<Token>& out);
+    bool parseAnd(const char*& s, const char* end, std::vector<Token>& out);
+    bool parseUnary(const char*& s, const char* end, std::vector<Token>& out);
+    bool parseLoop(const char* s, const char* end, Rule& r);
+    static int number(const char* s, const char* end, int maxDigits);
+    static int inputIndex(int pin);
+    static int outputIndex(int pin);
+    
+    void sample(unsigned long ms);
+    bool evaluate(const Rule& r) const;
+    void request(byte output, byte duty);
+    void check(Rule& r, unsigned long ms);
+    void setTimer(Rule& r, bool q);
+    void commit(unsigned long timeUs);
+    
+    byte arbitration;
+    std::vector<Rule> rules;
+    size_t cursor;                   // Текущая простая команда (как currentRule)
+    
+    byte levels[INPUT_COUNT];        // Уровни на входах
+    byte integrator[INPUT_COUNT];    // Антидребезг
+    bool stable[INPUT_COUNT];        // Вход стабильно в LOW
+    unsigned long lastMs;
+    
+    word analogLevels[8];            // Значение на канале и последняя выборка
+    word analogSampled[8];
+    byte analogChannels;             // Каналы аналоговых условий
+    byte analogPolled;
+    
+    Pin frame[OUTPUT_COUNT];
+    Pin board[OUTPUT_COUNT];
+    std::vector<EgHostOutput> log;
+};
+
+#endif
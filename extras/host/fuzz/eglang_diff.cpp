@@ -0,0 +1,484 @@
+// Дифференциальная проверка EgLang на хосте: случайные программы правил
+// и случайные сценарии входов (с дребезгом) идут через эталон и через
+// все пути библиотеки, журналы выходов должны совпасть до микросекунды, а
+// образы egCompileRule() - с образами parse() байт в байт:
+//   eglang_diff [seed] [программ]
+// Эталон - отдельная модель языка (EgRefModel): свой разбор текста, все
+// правила каждый цикл, свои таймеры и арбитраж, поэтому ошибка в общем для
+// путей разборе или вычислении условий тоже видна. При расхождении печатает
+// программу, сценарий и первое отличие; "eglang_diff seed_случая 1" повторяет его.
+// С EGLANG_ANALOG в программах есть условия по каналам АЦП и ШИМ, а в
+// сценариях - изменения аналоговых значений
+
+#include <EgLang.h>
+#include <EgLangLoader.h>
+#include "EgHostHal.h"
+#include "EgRefModel.h"
+
+#include <algorithm>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+static const byte kInputs[] = { EGLANG_INPUT_PINS };
+static const byte kOutputs[] = { EGLANG_OUTPUT_PINS };
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+static const byte kAnalogPins[] = { EGLANG_ANALOG_PINS };
+#endif
+
+// Каждый LONG_CASE-й случай идет LONG_RUN_MS с таймерами и шагами у верхней
+// границы 0..65535 мс: срок больше 16-битного оборота millis()
+enum { MAX_EVENTS = 64, RUN_MS = 3000, LONG_RUN_MS = 140000, LONG_CASE = 8, EXPR_DEPTH = 3 };
+
+// Пути библиотеки, которые сравниваются с эталоном
+enum Engine : byte {
+    ENGINE_FULL = 0,                 // add(), все правила каждый цикл
+    ENGINE_INCREMENTAL,              // add(), обычный run()
+    ENGINE_FLASH,                    // Образы через addFlash()
+    ENGINE_COMPILED,                 // Образы egCompileRule() (RF()) через addFlash()
+    ENGINE_IMAGE,                    // saveImage()/loadImage() через EEPROM
+    ENGINE_LOADER,                   // EgRuleLoader и замена набора в run()
+    ENGINE_LUT,                      // compileLut()
+    ENGINE_OPTIMIZED,                // add(), затем optimize()
+    ENGINE_COUNT
+};
+
+static const char* const kEngineNames[ENGINE_COUNT] = {
+    "full", "incremental", "flash", "compiled", "image", "loader", "lut", "optimized"
+};
+
+static unsigned long rng;
+static bool longCase;                       // Случай с длинными таймерами
+
+static unsigned long nextRandom() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static int pick(int n) {
+    return (int)(nextRandom() % (unsigned long)n);
+}
+
+// Длительность таймера или шага: до shortMax мс, в длинном случае -
+// иногда у верхней границы
+static unsigned genDuration(int shortMax) {
+    if (longCase && pick(2)) return 65535 - pick(200);
+    return pick(shortMax);
+}
+
+// Дописывает в buf; при переполнении правило просто не пройдет parse()
+static void append(char* buf, size_t size, const char* format, ...) {
+    size_t used = strlen(buf);
+    if (used + 1 >= size) return;
+    
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf + used, size - used, format, args);
+    va_end(args);
+}
+
+// Значение канала АЦП с момента timeUs
+struct AnalogEvent {
+    unsigned long timeUs;
+    byte channel;
+    word value;
+};
+
+// Программа и сценарий одного случая
+struct Case {
+    char rules[MAX_RULES][MAX_RULE_LENGTH];
+    int count;
+    byte arbitration;
+    int scanMs;
+    int runMs;
+    EgHostInputEvent events[MAX_EVENTS];
+    int eventCount;
+    AnalogEvent analog[MAX_EVENTS];
+    int analogCount;
+    bool usesAnalog;                        // Аналоговые условия или ШИМ: без LUT
+};
+
+// Выражение условия над pins: пары, ~, &, |, скобки
+static void genExpr(char* buf, size_t size, const byte* pins, int n, int depth) {
+    switch (depth > 0 ? pick(5) : 0) {
+        case 0:
+            append(buf, size, "%d,%d", pins[pick(n)], pick(2));
+            break;
+        case 1:
+            append(buf, size, "~");
+            genExpr(buf, size, pins, n, depth - 1);
+            break;
+        case 2:
+        case 3:
+            genExpr(buf, size, pins, n, depth - 1);
+            append(buf, size, pick(2) ? "&" : "|");
+            genExpr(buf, size, pins, n, depth - 1);
+            break;
+        default:
+            append(buf, size, "(");
+            genExpr(buf, size, pins, n, depth - 1);
+            append(buf, size, ")");
+            break;
+    }
+}
+
+static void genCommands(char* buf, size_t size, bool timed) {
+    int n = 1 + pick(4);
+    for (int k = 0; k < n; k++) {
+        append(buf, size, "%s%d,%d", k ? ";" : "", kOutputs[pick(OUTPUT_COUNT)], pick(2));
+        if (timed) append(buf, size, "@%u", genDuration(250));
+    }
+}
+
+// Действие "P,S" или, с EGLANG_ANALOG, иногда "P,=D"
+static void genAction(char* buf, size_t size, int out) {
+#if EGLANG_ANALOG
+    if (pick(3) == 0) {
+        append(buf, size, "%d,=%d", out, pick(3) ? pick(256) : 255 * pick(2));
+        return;
+    }
+#endif
+    append(buf, size, "%d,%d", out, pick(2));
+}
+
+// Случайное правило любого вида; часть получается неверной и отсеивается
+static void genRule(char* buf, size_t size) {
+    byte pins[4];
+    int n = 1 + pick(4);
+    for (int i = 0; i < n; i++) pins[i] = kInputs[pick(INPUT_COUNT)];
+    
+    int out = kOutputs[pick(OUTPUT_COUNT)];
+    buf[0] = '\0';
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+    if (pick(4) == 0) {
+        // Порог рядом с гистерезисом, чтобы он срабатывал
+        append(buf, size, "%cA%d%c%d", "?^"[pick(2)], pick(ANALOG_COUNT), "<>"[pick(2)], 400 + pick(200));
+        if (buf[0] == '?' && pick(3) == 0) append(buf, size, "%c%u", "+-*"[pick(3)], genDuration(400));
+        append(buf, size, "!");
+        genAction(buf, size, out);
+        return;
+    }
+#endif
+    switch (pick(7)) {
+        case 0:
+            genAction(buf, size, out);
+            break;
+        case 1:
+        case 2:
+            append(buf, size, "?");
+            genExpr(buf, size, pins, n, pick(EXPR_DEPTH + 1));
+            append(buf, size, "!");
+            genAction(buf, size, out);
+            break;
+        case 3:
+            append(buf, size, "^");
+            genExpr(buf, size, pins, n, pick(EXPR_DEPTH));
+            append(buf, size, "!%d,%c", out, "01~"[pick(3)]);
+            break;
+        case 4:
+            append(buf, size, "?");
+            genExpr(buf, size, pins, n, pick(EXPR_DEPTH));
+            append(buf, size, "%c%u!%d,%d", "+-*"[pick(3)], genDuration(400), out, pick(2));
+            break;
+        default:
+            append(buf, size, "[%d:", pins[0]);
+            genCommands(buf, size, pick(2) == 0);
+            append(buf, size, "]");
+            break;
+    }
+}
+
+// Повтор или сужение прошлого условного правила с уровнем: "?У!P,S" ->
+// то же или "?(У)&пин,s!P,s'" - материал для optimize() (повторы,
+// перекрытые правила и противоречия)
+static bool genDerived(const Case& c, char* buf, size_t size) {
+    const char* prev = c.rules[pick(c.count)];
+    const char* bang = strchr(prev, '!');
+    if (prev[0] != '?' || !bang || strpbrk(prev, "+-*A") || strchr(bang, '=')) return false;
+    
+    buf[0] = '\0';
+    if (pick(3) == 0) {
+        append(buf, size, "%s", prev);
+        return true;
+    }
+    append(buf, size, "?(%.*s)&%d,%d", (int)(bang - prev - 1), prev + 1, kInputs[pick(INPUT_COUNT)], pick(2));
+    append(buf, size, "!%.*s%d", (int)(strchr(bang, ',') - bang), bang + 1, pick(2));
+    return true;
+}
+
+// Программа из правил, которые принимает parse() и вмещает арена
+static void genProgram(Case& c) {
+    c.count = 0;
+    c.usesAnalog = false;
+    int target = 1 + pick(MAX_RULES);
+    word used = 0;
+    for (int attempt = 0; attempt < 4 * target && c.count < target; attempt++) {
+        char text[MAX_RULE_LENGTH + 16];
+        if (c.count == 0 || pick(4) || !genDerived(c, text, sizeof(text))) genRule(text, sizeof(text));
+    
+        RuleImage image;
+        if (strlen(text) >= MAX_RULE_LENGTH || !image.parse(text)) continue;
+        if (used + image.size() > EGLANG_ARENA_SIZE || used + image.size() > EGLANG_SHADOW_SIZE) break;
+    
+        used += image.size();
+        strcpy(c.rules[c.count++], text);
+        if (strchr(text, 'A') || strchr(text, '=')) c.usesAnalog = true;
+    }
+    c.arbitration = pick(ARB_AND + 1);
+    c.scanMs = 1 + pick(20);
+    c.runMs = longCase ? LONG_RUN_MS : RUN_MS;
+}
+
+// Нажатия и отпускания; часть - пачки коротких переключений (дребезг)
+static void genScenario(Case& c) {
+    c.eventCount = 0;
+    int presses = pick(MAX_EVENTS / 4);
+    for (int k = 0; k < presses && c.eventCount < MAX_EVENTS - 4; k++) {
+        unsigned long at = pick(c.runMs) * 1000UL + pick(1000);
+        byte pin = kInputs[pick(INPUT_COUNT)];
+        byte level = pick(2);
+        int bounces = pick(3) ? 0 : 1 + pick(3);
+        for (int b = 0; b <= bounces; b++) {
+            EgHostInputEvent e = { at, pin, (byte)((level + bounces - b) & 1) };
+            c.events[c.eventCount++] = e;
+            at += 100 + pick(3000);
+        }
+    }
+    
+    // По времени - для печати и эталона; schedule() и сам сохраняет порядок
+    for (int k = 1; k < c.eventCount; k++) {
+        EgHostInputEvent e = c.events[k];
+        int j = k;
+        for (; j > 0 && c.events[j - 1].timeUs > e.timeUs; j--) c.events[j] = c.events[j - 1];
+        c.events[j] = e;
+    }
+    
+    // Аналоговые значения: медленные изменения около порогов (уже по времени).
+    // Начинаются после первого цикла: набор EgRuleLoader подключается в нем,
+    // а подключение сразу читает каналы
+    c.analogCount = 0;
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+    unsigned long at = 2000;
+    while (c.analogCount < MAX_EVENTS) {
+        at += pick(c.runMs / 8) * 1000UL + pick(1000);
+        if (at >= c.runMs * 1000UL) break;
+        AnalogEvent e = { at, (byte)pick(ANALOG_COUNT), (word)(350 + pick(300)) };
+        c.analog[c.analogCount++] = e;
+    }
+#endif
+}
+
+static void printCase(const Case& c, unsigned long seed) {
+    printf("  seed %lu, arbitration %d, scan %d ms, run %d ms\n", seed, c.arbitration, c.scanMs, c.runMs);
+    for (int i = 0; i < c.count; i++) printf("  R(\"%s\");\n", c.rules[i]);
+    for (int k = 0; k < c.eventCount; k++) {
+        printf("  %8lu us pin %d -> %d\n", c.events[k].timeUs, c.events[k].pin, c.events[k].level);
+    }
+    for (int k = 0; k < c.analogCount; k++) {
+        printf("  %8lu us A%d -> %u\n", c.analog[k].timeUs, c.analog[k].channel, c.analog[k].value);
+    }
+}
+
+// egCompileRule() здесь вычисляется во время выполнения, и для неверного
+// правила вызывается эта функция: образ с valid = 0
+RuleImage egInvalidRule(const char*) {
+    RuleImage image;
+    memset(&image, 0, sizeof(image));
+    return image;
+}
+
+// Образ RF() должен совпасть с образом parse() байт в байт
+static bool compileRule(const char* text, RuleImage& image) {
+    RuleImage parsed;
+    image = egCompileRule(text);
+    if (parsed.parse(text) && image.header.valid && memcmp(&image, &parsed, parsed.size()) == 0) return true;
+    
+    printf("IMAGE compiled: \"%s\"\n  parse()        ", text);
+    for (byte k = 0; k < parsed.size(); k++) printf(" %02X", ((const byte*)&parsed)[k]);
+    printf("\n  egCompileRule()");
+    for (byte k = 0; k < image.size(); k++) printf(" %02X", ((const byte*)&image)[k]);
+    printf("\n");
+    return false;
+}
+
+// Новая плата и контроллер, программа case через путь engine
+static bool load(Engine engine, const Case& c) {
+    static RuleImage flash[MAX_RULES];
+    
+    EgHostHal::reset();
+    _eglang = EgLangController();
+    _eglang.init();
+    _eglang.setArbitration(c.arbitration);
+    
+    if (engine == ENGINE_FLASH) {
+        for (int i = 0; i < c.count; i++) {
+            if (!flash[i].parse(c.rules[i]) || !_eglang.addFlash(&flash[i])) return false;
+        }
+        return true;
+    }
+    
+    if (engine == ENGINE_COMPILED) {
+        for (int i = 0; i < c.count; i++) {
+            if (!compileRule(c.rules[i], flash[i]) || !_eglang.addFlash(&flash[i])) return false;
+        }
+        return true;
+    }
+    
+    if (engine == ENGINE_LOADER) {
+        // Теневой банк должен жить до замены набора в первом run()
+        static EgRuleLoader loader;
+        loader.abort();
+        for (int i = 0; i < c.count; i++) {
+            for (const char* p = c.rules[i]; *p; p++) loader.feed(*p);
+            loader.feed('\n');
+        }
+        for (const char* p = "END\n"; *p; p++) loader.feed(*p);
+        return loader.state() == LOADER_PENDING;
+    }
+    
+    for (int i = 0; i < c.count; i++) {
+        if (!_eglang.add(c.rules[i])) return false;
+    }
+    if (engine == ENGINE_IMAGE) {
+        if (!_eglang.saveImage()) return false;
+        _eglang.clearRules();
+        return _eglang.loadImage() && _eglang.count == c.count;
+    }
+    if (engine == ENGINE_LUT) return _eglang.compileLut();
+    if (engine == ENGINE_OPTIMIZED) return _eglang.optimize();
+    return true;
+}
+
+// Сценарий от текущего момента, цикл каждые scanMs мс. Возвращает начало
+// сценария - время init() в эталоне
+static unsigned long simulate(Engine engine, const Case& c) {
+    unsigned long start = EgHostHal::now();
+    for (int k = 0; k < c.eventCount; k++) {
+        EgHostHal::schedule(start + c.events[k].timeUs, c.events[k].pin, c.events[k].level);
+    }
+    
+    RuleMask all = (c.count < (int)sizeof(RuleMask) * 8) ? (((RuleMask)1 << c.count) - 1) : ~(RuleMask)0;
+    int analog = 0;
+    for (int ms = 0; ms < c.runMs; ms++) {
+        EgHostHal::advance(1000);
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+        for (; analog < c.analogCount && start + c.analog[analog].timeUs <= EgHostHal::now(); analog++) {
+            EgHostHal::setAnalog(kAnalogPins[c.analog[analog].channel], c.analog[analog].value);
+        }
+#else
+        (void)analog;
+#endif
+        if (ms % c.scanMs) continue;
+        if (engine == ENGINE_FULL) _eglang.dirtyRules = all;
+        _eglang.run();
+    }
+    return start;
+}
+
+// Тот же сценарий через эталонную модель; false - модель не приняла правило
+static bool reference(const Case& c, std::vector<EgHostOutput>& trace) {
+    EgRefModel model(c.arbitration);
+    for (int i = 0; i < c.count; i++) {
+        if (!model.add(c.rules[i])) {
+            printf("REJECTED reference: rule %d\n", i);
+            return false;
+        }
+    }
+    
+    int event = 0;
+    int analog = 0;
+    for (int ms = 0; ms < c.runMs; ms++) {
+        unsigned long now = (ms + 1) * 1000UL;
+        for (; event < c.eventCount && c.events[event].timeUs <= now; event++) {
+            model.setInput(c.events[event].pin, c.events[event].level);
+        }
+        for (; analog < c.analogCount && c.analog[analog].timeUs <= now; analog++) {
+            model.setAnalog(c.analog[analog].channel, c.analog[analog].value);
+        }
+        if (ms % c.scanMs == 0) model.scan(now);
+    }
+    trace = model.outputs();
+    return true;
+}
+
+// Записи одного момента - по пинам: порядок внутри кадра не часть языка
+static bool earlier(const EgHostOutput& a, const EgHostOutput& b) {
+    return a.timeUs != b.timeUs ? a.timeUs < b.timeUs : a.pin < b.pin;
+}
+
+static bool sameOutput(const EgHostOutput& a, const EgHostOutput& b) {
+    return a.timeUs == b.timeUs && a.pin == b.pin && a.value == b.value;
+}
+
+// Первое отличие журнала от эталона (время от start); false - журналы совпали
+static bool report(Engine engine, const std::vector<EgHostOutput>& expected, unsigned long start) {
+    std::vector<EgHostOutput> got = EgHostHal::outputs();
+    for (size_t k = 0; k < got.size(); k++) got[k].timeUs -= start;
+    std::stable_sort(got.begin(), got.end(), earlier);
+    
+    size_t k = 0;
+    while (k < expected.size() && k < got.size() && sameOutput(expected[k], got[k])) k++;
+    if (k == expected.size() && k == got.size()) return false;
+    
+    printf("MISMATCH %s: output %zu of %zu/%zu\n", kEngineNames[engine], k, expected.size(), got.size());
+    if (k < expected.size()) {
+        printf("  expected %lu us pin %d -> %d\n", expected[k].timeUs, expected[k].pin, expected[k].value);
+    }
+    if (k < got.size()) printf("  got      %lu us pin %d -> %d\n", got[k].timeUs, got[k].pin, got[k].value);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    unsigned long seed = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1;
+    long programs = (argc > 2) ? atol(argv[2]) : 2000;
+    
+    static Case c;
+    unsigned long rules = 0, changes = 0;
+    int mismatches = 0;
+    for (long n = 0; n < programs; n++) {
+        unsigned long caseSeed = seed + n;
+        rng = caseSeed * 2654435761UL | 1;
+        longCase = caseSeed % LONG_CASE == 0;
+        genProgram(c);
+        genScenario(c);
+        if (c.count == 0) continue;
+        rules += c.count;
+    
+        std::vector<EgHostOutput> expected;
+        if (!reference(c, expected)) {
+            printCase(c, caseSeed);
+            return 1;
+        }
+        std::stable_sort(expected.begin(), expected.end(), earlier);
+        changes += expected.size();
+    
+        for (byte e = ENGINE_FULL; e < ENGINE_COUNT; e++) {
+            Engine engine = (Engine)e;
+#if !EGLANG_LUT
+            if (engine == ENGINE_LUT) continue;
+#endif
+#if !EGLANG_OPTIMIZE
+            if (engine == ENGINE_OPTIMIZED) continue;
+#endif
+            if (engine == ENGINE_LUT && c.usesAnalog) continue;
+            bool failed;
+            if (!load(engine, c)) {
+                printf("REJECTED %s\n", kEngineNames[engine]);
+                failed = true;
+            } else {
+                unsigned long start = simulate(engine, c);
+                failed = report(engine, expected, start);
+            }
+            if (failed) {
+                printCase(c, caseSeed);
+                if (++mismatches >= 10) return 1;
+            }
+        }
+    }
+    
+    printf("%ld programs, %lu rules, %lu output changes, %d mismatches\n", programs, rules, changes, mismatches);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+// Фаззинг разбора правил и проверки записей (входы из текста и из EEPROM
+// недоверенные). Первый байт выбирает цель:
+//   четный  - остальное как текст правила: RuleImage::parse()
+//   нечетный - остальное как запись (заголовок и код): RuleImage::wellFormed()
+// Принятое правило подключается к контроллеру, проходит optimize() и несколько циклов.
+// С libFuzzer (clang, -DEGLANG_LIBFUZZER=ON) - обычный LLVMFuzzerTestOneInput;
+// без него - прогон файлов корпуса: eglang_fuzz_parse файл...
+
+#include <EgLang.h>
+#include "EgHostHal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FUZZ_CHECK(cond) do { if (!(cond)) { fprintf(stderr, "check failed: %s\n", #cond); abort(); } } while (0)
+
+// Правило на свежем контроллере: входы меняются между циклами
+static void exercise(const RuleImage* image, bool inFlash, const uint8_t* data, size_t size) {
+    EgHostHal::reset();
+    EgHostHal::setRecording(false);
+    _eglang = EgLangController();
+    _eglang.init();
+    
+    if (inFlash) {
+        if (!_eglang.addFlash(image)) return;
+    } else {
+        if (!_eglang.add((const char*)data)) return;
+    }
+    _eglang.optimize();
+    
+    static const byte kInputs[] = { EGLANG_INPUT_PINS };
+    for (size_t k = 0; k < 16; k++) {
+        byte bits = size ? data[k % size] : 0;
+        EgHostHal::setInput(kInputs[k % INPUT_COUNT], bits & 1);
+        EgHostHal::advance(7000);
+        _eglang.run();
+    }
+}
+
+static void fuzzText(const uint8_t* data, size_t size) {
+    char text[2 * MAX_RULE_LENGTH];
+    if (size >= sizeof(text)) size = sizeof(text) - 1;
+    memcpy(text, data, size);
+    text[size] = '\0';
+    
+    RuleImage image;
+    bool ok = image.parse(text);
+    if (!ok) {
+        FUZZ_CHECK(!image.header.valid && image.header.length == 0);
+        return;
+    }
+    
+    // Принятая запись структурно верна и не зависит от прошлого разбора
+    FUZZ_CHECK(strlen(text) < MAX_RULE_LENGTH);
+    FUZZ_CHECK(image.header.length <= MAX_RULE_CODE);
+    FUZZ_CHECK(image.wellFormed());
+    
+    RuleImage again;
+    memset(&again, 0xA5, sizeof(again));
+    FUZZ_CHECK(again.parse(text));
+    FUZZ_CHECK(memcmp(&again.header, &image.header, sizeof(image.header)) == 0);
+    FUZZ_CHECK(memcmp(again.code, image.code, image.header.length) == 0);
+    
+    exercise(&image, false, (const uint8_t*)text, strlen(text));
+}
+
+static void fuzzRecord(const uint8_t* data, size_t size) {
+    static RuleImage image;
+    memset(&image, 0, sizeof(image));
+    memcpy(&image, data, size < sizeof(image) ? size : sizeof(image));
+    if (!image.wellFormed()) return;
+    
+    FUZZ_CHECK(image.size() <= sizeof(image));
+    exercise(&image, true, data, size);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size == 0) return 0;
+    
+    if (data[0] & 1) {
+        fuzzRecord(data + 1, size - 1);
+    } else {
+        fuzzText(data + 1, size - 1);
+    }
+    return 0;
+}
+
+#if !EGLANG_LIBFUZZER
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        FILE* f = fopen(argv[i], "rb");
+        if (!f) {
+            perror(argv[i]);
+            return 1;
+        }
+    
+        uint8_t buf[256];
+        size_t size = fread(buf, 1, sizeof(buf), f);
+        fclose(f);
+        LLVMFuzzerTestOneInput(buf, size);
+    }
+    printf("%d inputs\n", argc - 1);
+    return 0;
+}
+#endif
@@ -0,0 +1,265 @@
+#include "EgHostHal.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+HardwareSerial Serial;
+
+// Плата без привязки (общая) и привязанная к потоку Scope. Указатель
+// потока без конструктора - обращение к нему не дороже глобальной переменной
+static EgHostBoard defaultBoard;
+static thread_local EgHostBoard* bound;
+
+EgHostBoard::EgHostBoard() : recording(true), serialEcho(false), eepromReady(false), eepromWriteCount(0) {
+    reset();
+}
+
+EgHostBoard& EgHostBoard::current() {
+    return bound ? *bound : defaultBoard;
+}
+
+EgHostBoard::Scope::Scope(EgHostBoard& board) : previous(bound) {
+    bound = &board;
+}
+
+EgHostBoard::Scope::~Scope() {
+    bound = previous;
+}
+
+void EgHostBoard::reset() {
+    for (int i = 0; i < EGLANG_HOST_PINS; i++) {
+        pinLevels[i] = HIGH;
+        pinModes[i] = INPUT;
+        pinDuty[i] = 0;
+        analogLevels[i] = 0;
+    }
+    clockUs = 0;
+    script.clear();
+    scriptPos = 0;
+    outputLog.clear();
+    writeCount = 0;
+}
+
+void EgHostBoard::setInput(byte pin, byte level) {
+    if (pin < EGLANG_HOST_PINS) pinLevels[pin] = level ? HIGH : LOW;
+}
+
+void EgHostBoard::setAnalog(byte pin, word value) {
+    if (pin < EGLANG_HOST_PINS) analogLevels[pin] = value;
+}
+
+void EgHostBoard::schedule(unsigned long timeUs, byte pin, byte level) {
+    EgHostInputEvent e = { timeUs, pin, level };
+    
+    // Вставка с сохранением порядка по времени (стабильно для равных моментов)
+    std::vector<EgHostInputEvent>::iterator it = std::upper_bound(
+        script.begin() + scriptPos, script.end(), e,
+        [](const EgHostInputEvent& a, const EgHostInputEvent& b) { return a.timeUs < b.timeUs; });
+    script.insert(it, e);
+}
+
+void EgHostBoard::advance(unsigned long us) {
+    clockUs += us;
+    while (scriptPos < script.size() && script[scriptPos].timeUs <= clockUs) {
+        setInput(script[scriptPos].pin, script[scriptPos].level);
+        scriptPos++;
+    }
+}
+
+byte EgHostBoard::level(byte pin) const {
+    return pin < EGLANG_HOST_PINS ? pinLevels[pin] : LOW;
+}
+
+byte EgHostBoard::mode(byte pin) const {
+    return pin < EGLANG_HOST_PINS ? pinModes[pin] : INPUT;
+}
+
+byte EgHostBoard::duty(byte pin) const {
+    return pin < EGLANG_HOST_PINS ? pinDuty[pin] : 0;
+}
+
+void EgHostBoard::eraseEeprom() {
+    memset(eepromData, 0xFF, sizeof(eepromData));
+    eepromReady = true;
+    eepromWriteCount = 0;
+}
+
+byte* EgHostBoard::eeprom() {
+    if (!eepromReady) eraseEeprom();
+    return eepromData;
+}
+
+void EgHostBoard::pinMode(byte pin, byte mode) {
+    if (pin >= EGLANG_HOST_PINS) return;
+    pinModes[pin] = mode;
+    if (mode == INPUT_PULLUP) pinLevels[pin] = HIGH;
+}
+
+void EgHostBoard::record(byte pin, byte value) {
+    writeCount++;
+    if (recording) {
+        EgHostOutput e = { clockUs, pin, value };
+        outputLog.push_back(e);
+    }
+}
+
+void EgHostBoard::digitalWrite(byte pin, byte value) {
+    if (pin >= EGLANG_HOST_PINS) return;
+    value = value ? HIGH : LOW;
+    pinLevels[pin] = value;
+    pinDuty[pin] = value ? 255 : 0;
+    record(pin, value);
+}
+
+// Как в ядре Arduino: пин в OUTPUT, 0 и 255 - обычные LOW и HIGH
+void EgHostBoard::analogWrite(byte pin, int value) {
+    if (pin >= EGLANG_HOST_PINS) return;
+    pinModes[pin] = OUTPUT;
+    if (value <= 0 || value >= 255) {
+        digitalWrite(pin, value > 0);
+        return;
+    }
+    pinLevels[pin] = HIGH;
+    pinDuty[pin] = (byte)value;
+    record(pin, (byte)value);
+}
+
+int EgHostBoard::analogRead(byte pin) const {
+    return pin < EGLANG_HOST_PINS ? analogLevels[pin] : 0;
+}
+
+int EgHostBoard::digitalRead(byte pin) const {
+    return pin < EGLANG_HOST_PINS ? pinLevels[pin] : LOW;
+}
+
+void EgHostBoard::serialWrite(byte c) {
+    if (serialEcho) fputc(c, stdout);
+}
+
+void EgHostBoard::eepromWrite(size_t addr, byte value) {
+    if (addr > E2END) return;
+    eeprom()[addr] = value;
+    eepromWriteCount++;
+}
+
+// Прежний статический интерфейс
+
+void EgHostHal::reset() { EgHostBoard::current().reset(); }
+void EgHostHal::setInput(byte pin, byte level) { EgHostBoard::current().setInput(pin, level); }
+void EgHostHal::setAnalog(byte pin, word value) { EgHostBoard::current().setAnalog(pin, value); }
+
+void EgHostHal::schedule(unsigned long timeUs, byte pin, byte level) {
+    EgHostBoard::current().schedule(timeUs, pin, level);
+}
+
+void EgHostHal::schedule(const EgHostInputEvent* events, size_t count) {
+    EgHostBoard& board = EgHostBoard::current();
+    for (size_t i = 0; i < count; i++) {
+        board.schedule(events[i].timeUs, events[i].pin, events[i].level);
+    }
+}
+
+unsigned long EgHostHal::now() { return EgHostBoard::current().now(); }
+void EgHostHal::advance(unsigned long us) { EgHostBoard::current().advance(us); }
+byte EgHostHal::level(byte pin) { return EgHostBoard::current().level(pin); }
+byte EgHostHal::mode(byte pin) { return EgHostBoard::current().mode(pin); }
+byte EgHostHal::duty(byte pin) { return EgHostBoard::current().duty(pin); }
+const std::vector<EgHostOutput>& EgHostHal::outputs() { return EgHostBoard::current().outputs(); }
+unsigned long EgHostHal::writes() { return EgHostBoard::current().writes(); }
+void EgHostHal::setRecording(bool on) { EgHostBoard::current().setRecording(on); }
+void EgHostHal::setSerialEcho(bool on) { EgHostBoard::current().setSerialEcho(on); }
+void EgHostHal::eraseEeprom() { EgHostBoard::current().eraseEeprom(); }
+byte* EgHostHal::eeprom() { return EgHostBoard::current().eeprom(); }
+unsigned long EgHostHal::eepromWrites() { return EgHostBoard::current().eepromWrites(); }
+
+// Arduino API поверх платы потока
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    EgHostBoard::current().pinMode(pin, mode);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    EgHostBoard::current().digitalWrite(pin, value);
+}
+
+void analogWrite(uint8_t pin, int value) {
+    EgHostBoard::current().analogWrite(pin, value);
+}
+
+int analogRead(uint8_t pin) {
+    return EgHostBoard::current().analogRead(pin);
+}
+
+int digitalRead(uint8_t pin) {
+    return EgHostBoard::current().digitalRead(pin);
+}
+
+unsigned long millis() {
+    return EgHostBoard::current().now() / 1000;
+}
+
+unsigned long micros() {
+    return EgHostBoard::current().now();
+}
+
+void delay(unsigned long ms) {
+    EgHostBoard::current().advance(ms * 1000UL);
+}
+
+void delayMicroseconds(unsigned int us) {
+    EgHostBoard::current().advance(us);
+}
+
+// avr/eeprom.h поверх симулятора: адрес - смещение в EEPROM
+
+uint8_t eeprom_read_byte(const uint8_t* addr) {
+    size_t a = (size_t)addr;
+    return a <= E2END ? EgHostHal::eeprom()[a] : 0xFF;
+}
+
+void eeprom_write_byte(uint8_t* addr, uint8_t value) {
+    EgHostBoard::current().eepromWrite((size_t)addr, value);
+}
+
+void eeprom_update_byte(uint8_t* addr, uint8_t value) {
+    if (eeprom_read_byte(addr) != value) eeprom_write_byte(addr, value);
+}
+
+void eeprom_read_block(void* dst, const void* src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        ((uint8_t*)dst)[i] = eeprom_read_byte((const uint8_t*)src + i);
+    }
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+}
+
+size_t Print::print(long n, int base) {
+    if (n < 0 && base == DEC) {
+        return print('-') + print((unsigned long)-n, base);
+    }
+    return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+    char buf[8 * sizeof(long) + 1];
+    char* p = &buf[sizeof(buf) - 1];
+    *p = '\0';
+    if (base < 2) base = DEC;
+    
+    do {
+        byte digit = n % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        n /= base;
+    } while (n);
+    
+    return write(p);
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    EgHostBoard::current().serialWrite(c);
+    return 1;
+}
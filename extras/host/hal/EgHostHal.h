@@ -0,0 +1,133 @@
+#ifndef EGLANG_HOST_HAL_H
+#define EGLANG_HOST_HAL_H
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+#include <vector>
+
+// Симулятор платы для хост-сборки: виртуальное время в микросекундах,
+// сценарии входов (волновые формы) и запись изменений выходов
+
+#define EGLANG_HOST_PINS 70              // Mega: пины до A15 (69)
+
+// Изменение выхода, записанное digitalWrite() (value 0/1)
+// или analogWrite() (value - скважность)
+struct EgHostOutput {
+    unsigned long timeUs;
+    byte pin;
+    byte value;
+};
+
+// Запланированное изменение входа
+struct EgHostInputEvent {
+    unsigned long timeUs;
+    byte pin;
+    byte level;
+};
+
+// Одна виртуальная плата: пины, время, сценарий, журнал выходов и EEPROM.
+// Arduino API хост-сборки работает с платой, привязанной к потоку
+// (EgHostBoard::Scope); без привязки - с общей платой по умолчанию.
+// Так каждый поток симулятора ведет свой контроллер на своей плате
+class EgHostBoard {
+public:
+    EgHostBoard();
+    
+    void reset();
+    void setInput(byte pin, byte level);
+    void schedule(unsigned long timeUs, byte pin, byte level);
+    void setAnalog(byte pin, word value);
+    
+    unsigned long now() const { return clockUs; }
+    void advance(unsigned long us);
+    
+    byte level(byte pin) const;
+    byte mode(byte pin) const;
+    byte duty(byte pin) const;
+    const std::vector<EgHostOutput>& outputs() const { return outputLog; }
+    unsigned long writes() const { return writeCount; }
+    void setRecording(bool on) { recording = on; }
+    void setSerialEcho(bool on) { serialEcho = on; }
+    
+    void eraseEeprom();
+    byte* eeprom();
+    unsigned long eepromWrites() const { return eepromWriteCount; }
+    
+    // Arduino API этой платы
+    void pinMode(byte pin, byte mode);
+    void digitalWrite(byte pin, byte value);
+    void analogWrite(byte pin, int value);
+    int analogRead(byte pin) const;
+    int digitalRead(byte pin) const;
+    void serialWrite(byte c);
+    void eepromWrite(size_t addr, byte value);
+    
+    // Плата потока: привязанная Scope или общая плата по умолчанию
+    static EgHostBoard& current();
+    
+    // Привязка платы к потоку на время жизни объекта (вложенные - стеком)
+    class Scope {
+    public:
+        explicit Scope(EgHostBoard& board);
+        ~Scope();
+        
+    private:
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+        EgHostBoard* previous;
+    };
+    
+private:
+    EgHostBoard(const EgHostBoard&);
+    EgHostBoard& operator=(const EgHostBoard&);
+    void record(byte pin, byte value);
+    
+    byte pinLevels[EGLANG_HOST_PINS];        // Уровень на пине (вход или выход)
+    byte pinModes[EGLANG_HOST_PINS];
+    byte pinDuty[EGLANG_HOST_PINS];
+    word analogLevels[EGLANG_HOST_PINS];
+    unsigned long clockUs;
+    std::vector<EgHostInputEvent> script;    // Отсортирован по времени
+    size_t scriptPos;
+    std::vector<EgHostOutput> outputLog;
+    unsigned long writeCount;
+    bool recording;
+    bool serialEcho;
+    byte eepromData[E2END + 1];
+    bool eepromReady;
+    unsigned long eepromWriteCount;
+};
+
+// Прежний интерфейс симулятора: плата текущего потока (EgHostBoard::current())
+class EgHostHal {
+public:
+    // Все входы в HIGH (подтяжка), время 0, журналы пусты
+    static void reset();
+    
+    // Входы: немедленно или по сценарию в момент timeUs
+    static void setInput(byte pin, byte level);
+    static void schedule(unsigned long timeUs, byte pin, byte level);
+    static void schedule(const EgHostInputEvent* events, size_t count);
+    static void setAnalog(byte pin, word value); // Значение analogRead() (0 после reset())
+    
+    // Виртуальное время: advance() применяет наступившие события сценария
+    static unsigned long now();
+    static void advance(unsigned long us);
+    
+    // Выходы
+    static byte level(byte pin);
+    static byte mode(byte pin);
+    static byte duty(byte pin);         // Последняя скважность analogWrite(); digitalWrite() - 0 или 255
+    static const std::vector<EgHostOutput>& outputs();
+    static unsigned long writes();
+    static void setRecording(bool on);  // Журнал outputs() (по умолчанию включен)
+    
+    static void setSerialEcho(bool on); // Вывод Serial в stdout
+    
+    // EEPROM переживает reset(), как при перезагрузке платы
+    static void eraseEeprom();          // Все байты 0xFF
+    static byte* eeprom();              // E2END + 1 байт
+    static unsigned long eepromWrites(); // Физических записей байта
+};
+
+#endif
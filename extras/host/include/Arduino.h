@@ -0,0 +1,95 @@
+#ifndef EGLANG_HOST_ARDUINO_H
+#define EGLANG_HOST_ARDUINO_H
+
+// Минимальная замена Arduino.h для сборки EgLang на Linux.
+// Пины, время и Serial обслуживает плата симулятора текущего потока (EgHostBoard)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef uint16_t word;
+typedef bool boolean;
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define PSTR(s) (s)
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+#define noInterrupts()
+#define interrupts()
+
+class Print {
+public:
+    virtual ~Print() { }
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    virtual int availableForWrite() { return 0; }
+    
+    size_t write(const char* str) { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+    size_t print(const char* str) { return write(str); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T>
+    size_t println(T value, int base) { size_t n = print(value, base); return n + println(); }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+// Serial хост-сборки: вывод в stdout, если включен EgHostHal::setSerialEcho()
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long) { }
+    void end() { }
+    operator bool() { return true; }
+    
+    size_t write(uint8_t c) override;
+    using Print::write;
+    int availableForWrite() override { return 64; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
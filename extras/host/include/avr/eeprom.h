@@ -0,0 +1,15 @@
+#ifndef EGLANG_HOST_AVR_EEPROM_H
+#define EGLANG_HOST_AVR_EEPROM_H
+
+// Замена avr/eeprom.h: EEPROM платы симулятора текущего потока (1 КБ, как у ATmega328P)
+
+#include <Arduino.h>
+
+#define E2END 0x3FF
+
+uint8_t eeprom_read_byte(const uint8_t* addr);
+void eeprom_write_byte(uint8_t* addr, uint8_t value);
+void eeprom_update_byte(uint8_t* addr, uint8_t value);
+void eeprom_read_block(void* dst, const void* src, size_t n);
+
+#endif
@@ -0,0 +1,74 @@
+// Разбор двоичной трассировки EgLang (EGLANG_TRACE_BINARY=1) в текст:
+//   eglang_telemetry [файл]     (без файла - stdin, например из /dev/ttyUSB0)
+// Кадр: TRACE_SYNC тип a b(2) время(2) сумма. Кадры с неверной суммой
+// пропускаются со сдвигом на байт, в конце - число сбоев синхронизации
+
+#include <EgLangTrace.h>
+
+#include <stdio.h>
+
+static void printFrame(const byte* f, unsigned long& epoch, word& lastTime) {
+    byte type = f[1];
+    byte a = f[2];
+    word b = f[3] | (f[4] << 8);
+    word time = f[5] | (f[6] << 8);
+    
+    // Метка времени - 16 бит millis(): переполнение раз в 65.5 с
+    if (time < lastTime) epoch += 0x10000UL;
+    lastTime = time;
+    printf("%10lu ", epoch + time);
+    
+    switch (type) {
+        case TRACE_PIN_CHANGE: printf("CHANGE Pin %u -> %u\n", a, b); break;
+        case TRACE_LOOP_ENTER: printf("LOOP %u enter pin %u\n", a, b); break;
+        case TRACE_LOOP_EXIT:  printf("LOOP %u exit pin %u\n", a, b); break;
+        case TRACE_RULE_FIRE:  printf("RULE %u -> pin %u\n", a, b); break;
+        case TRACE_SHUTDOWN:   printf("SHUTDOWN\n"); break;
+        case TRACE_SCAN_STATS: printf("SCAN overruns %u jitter %u us\n", a, b); break;
+        case TRACE_DROPPED:    printf("DROPPED %u events\n", a); break;
+        default:               printf("UNKNOWN type %u a %u b %u\n", type, a, b); break;
+    }
+}
+
+int main(int argc, char** argv) {
+    FILE* in = (argc > 1) ? fopen(argv[1], "rb") : stdin;
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+    
+    byte frame[TRACE_FRAME_SIZE];
+    int filled = 0;
+    unsigned long frames = 0, resyncs = 0, epoch = 0;
+    word lastTime = 0;
+    
+    int c;
+    while ((c = fgetc(in)) != EOF) {
+        if (filled == 0 && c != TRACE_SYNC) {
+            resyncs++;
+            continue;
+        }
+        frame[filled++] = (byte)c;
+        if (filled < TRACE_FRAME_SIZE) continue;
+        
+        byte sum = 0;
+        for (int i = 1; i < TRACE_FRAME_SIZE - 1; i++) sum += frame[i];
+        if (sum == frame[TRACE_FRAME_SIZE - 1]) {
+            printFrame(frame, epoch, lastTime);
+            frames++;
+            filled = 0;
+            continue;
+        }
+        
+        // Неверная сумма: ищем следующий TRACE_SYNC внутри кадра
+        resyncs++;
+        int next = 1;
+        while (next < TRACE_FRAME_SIZE && frame[next] != TRACE_SYNC) next++;
+        for (int i = next; i < TRACE_FRAME_SIZE; i++) frame[i - next] = frame[i];
+        filled = TRACE_FRAME_SIZE - next;
+    }
+    
+    fprintf(stderr, "%lu frames, %lu sync errors\n", frames, resyncs);
+    if (in != stdin) fclose(in);
+    return 0;
+}
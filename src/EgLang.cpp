@@ -1,50 +1,200 @@
 #include "EgLang.h"
 
+#if EGLANG_EEPROM
+#include <avr/eeprom.h>
+#endif
+#if EGLANG_PCINT
+#include <avr/sleep.h>
+#endif
+
 // Конфигурация пинов в PROGMEM (экономия SRAM)
-const byte inputs[] PROGMEM = {3, 5, 7, 9, 11, 13};
-const byte outputs[] PROGMEM = {2, 4, 6, 8, 10, 12};
+const byte inputs[] PROGMEM = { EGLANG_INPUT_PINS };
+const byte outputs[] PROGMEM = { EGLANG_OUTPUT_PINS };
 
 // Глобальный контроллер
 EgLangController _eglang;
 
-// Конструктор Rule
-Rule::Rule() : done(false) {
-    ruleText[0] = '\0';
-    memset(&parsed, 0, sizeof(parsed));
-    parsed.valid = false;
+#if EGLANG_PCINT
+// Изменения входов с прошлой выборки: биты как в снимке, ставятся в PCINT,
+// сбрасываются в sampleInputs(). Дребезг тоже будит цикл - его гасит интегратор
+static volatile InputMask inputEvents;
+static volatile InputMask inputLast;
+
+static inline void latchInputs() {
+    InputMask raw = egReadInputs();
+    inputEvents |= raw ^ inputLast;
+    inputLast = raw;
+}
+
+ISR(PCINT0_vect) { latchInputs(); }
+ISR(PCINT1_vect) { latchInputs(); }
+ISR(PCINT2_vect) { latchInputs(); }
+#endif
+
+// Номер младшего установленного бита маски правил
+static inline byte lowestRule(RuleMask m) {
+    return sizeof(RuleMask) > sizeof(unsigned long) ? __builtin_ctzll(m) : __builtin_ctzl(m);
+}
+
+// Номер старшего установленного бита маски правил
+static inline byte highestRule(RuleMask m) {
+    return sizeof(RuleMask) > sizeof(unsigned long) ? 63 - __builtin_clzll(m) :
+           sizeof(unsigned long) * 8 - 1 - __builtin_clzl(m);
+}
+
+// Добавляет запись state в выход bit кадра (drive, value) по политике
+static void combineWrite(OutputMask& drive, OutputMask& value, OutputMask bit, byte state, byte policy) {
+    if (!(drive & bit)) {
+        drive |= bit;
+        if (state) value |= bit; else value &= ~bit;
+        return;
+    }
+    
+    switch (policy) {
+        case ARB_LAST:
+            if (state) value |= bit; else value &= ~bit;
+            break;
+        case ARB_PRIORITY:
+            break;
+        case ARB_OR:
+            if (state) value |= bit;
+            break;
+        case ARB_AND:
+            if (!state) value &= ~bit;
+            break;
+    }
+}
+
+// Инструкция и маска терма из байтов записи, младшим вперед
+static InstrCode loadInstr(const byte* p) {
+    InstrCode in = 0;
+    for (byte b = 0; b < INSTR_SIZE; b++) in |= (InstrCode)p[b] << (8 * b);
+    return in;
 }
 
-void Rule::setRule(const char* text) {
-    if (!text || !text[0]) return; // БАГ-ФИХ: Проверка пустой строки
+static InputMask loadMask(const byte* p) {
+    InputMask m = 0;
+    for (byte b = 0; b < MASK_SIZE; b++) m |= (InputMask)p[b] << (8 * b);
+    return m;
+}
+
+// Образ в EEPROM: 'E' 'g' версия подпись_пинов число_правил арбитраж размер(2),
+// затем записи правил подряд (как в арене) и сумма Флетчера-16 (2 байта)
+enum : byte { IMAGE_HEADER = 8, IMAGE_TRAILER = 2 };
+
+// Подпись списков пинов: индексы в образе действительны только для них
+static constexpr byte pinSignature(byte i = 0) {
+    return i >= INPUT_COUNT + OUTPUT_COUNT ? 0 :
+           (byte)(pinSignature(i + 1) * 31 + (i < INPUT_COUNT ? egInputPins[i] : egOutputPins[i - INPUT_COUNT]));
+}
+
+struct ImageChecksum {
+    byte a;
+    byte b;
     
-    strncpy(ruleText, text, MAX_RULE_LENGTH - 1);
-    ruleText[MAX_RULE_LENGTH - 1] = '\0';
-    parseRule();
+    void add(byte v) {
+        a = (a + v) % 255;
+        b = (b + a) % 255;
+    }
+};
+
+// Конструктор Rule
+Rule::Rule() : image(NULL), inFlash(false), done(false), inLoop(false), active(false),
+               step(0), stepStart(0) {
+    memset(&header, 0, sizeof(header));
+#if EGLANG_OPTIMIZE
+    sharedTerms = 0;
+    sharedAt = 0;
+#endif
+}
+
+// Все состояние с нуля: экземпляр на стеке или из new без () иначе
+// начинал бы с мусора (и мог бы считать себя уже инициализированным)
+EgLangController::EgLangController()
+    : arenaUsed(0), count(0), currentRule(0), initialized(false), lutMode(false), arbitration(ARB_LAST),
+      outputState(0), outputDriven(0), frameDrive(0), frameValue(0), requester(0),
+      highRules(0), releaseOutputs(0), continuousRules(0), liveRules(0), heldRules(0), dirtyRules(0), lastSnapshot(0),
+      timerTick(0), scanPeriodUs(0), nextScanUs(0), lastScanUs(0), scans(0), overruns(0),
+      jitterLastUs(0), jitterMaxUs(0), inputSnapshot(0), settlingInputs(0), lastSampleMs(0),
+      lutFlash(NULL), pendingRecords(NULL), pendingSize(0) {
+    memset(frameRule, 0, sizeof(frameRule));
+    memset(owners, 0, sizeof(owners));
+    memset(dependents, 0, sizeof(dependents));
+    memset(timerSlots, 0, sizeof(timerSlots));
+    memset(debounce, 0, sizeof(debounce));
+#if EGLANG_ANALOG
+    framePwm = 0;
+    outputPwm = 0;
+    memset(frameDuty, 0, sizeof(frameDuty));
+    memset(outputDuty, 0, sizeof(outputDuty));
+    analogRules = 0;
+    pwmRules = 0;
+    analogChannels = 0;
+#endif
+#if EGLANG_LUT
+    memset(lut, 0, sizeof(lut));
+#endif
+#if EGLANG_OPTIMIZE
+    sharedCount = 0;
+    sharedKnown = 0;
+    sharedMet = 0;
+    sharedSnapshot = 0;
+#endif
+#if EGLANG_TRACE_LEVEL > 0
+    trace.clear();
+#endif
+#if EGLANG_STATS
+    stats.clear();
+#endif
 }
 
 void EgLangController::init() {
     if (initialized) return;
     
+#if EGLANG_TRACE_LEVEL > 0
     // БАГ-ФИХ: Инициализация Serial для минимальной отладки
-    Serial.begin(9600);
+    Serial.begin(EGLANG_SERIAL_BAUD);
+    trace.clear();
+#endif
+#if EGLANG_STATS
+    stats.clear();
+#endif
     
     // Настройка пинов (читаем из PROGMEM)
-    for (byte i = 0; i < 6; i++) {
+    for (byte i = 0; i < INPUT_COUNT; i++) {
         pinMode(pgm_read_byte(&inputs[i]), INPUT_PULLUP);
+    }
+    for (byte i = 0; i < OUTPUT_COUNT; i++) {
         pinMode(pgm_read_byte(&outputs[i]), INPUT); // HIGH-Z
-        
-        // Инициализация состояний OUTPUT пинов
-        pinStates[i].pin = pgm_read_byte(&outputs[i]);
-        pinStates[i].state = 0;
-        pinStates[i].isOutput = 0;
     }
     
+    // Инициализация состояний OUTPUT пинов
+    outputState = 0;
+    outputDriven = 0;
+    
     count = 0;
     currentRule = 0;
     initialized = true;
     
     // БАГ-ФИХ: Небольшая задержка для стабилизации INPUT_PULLUP
     delay(10);
+    
+    // Начальный снимок входов: интеграторы сразу в установившемся состоянии
+    inputSnapshot = egReadInputs();
+    for (byte i = 0; i < INPUT_COUNT; i++) {
+        debounce[i] = ((inputSnapshot >> i) & 1) ? EGLANG_DEBOUNCE_MS : 0;
+    }
+    lastSnapshot = inputSnapshot;
+    lastSampleMs = millis();
+#if EGLANG_PCINT
+    inputLast = egReadInputs();
+    egArmPinChange();
+#endif
+    timerTick = lastSampleMs / EGLANG_TIMER_TICK_MS;
+    
+    if (!scanPeriodUs) scanPeriodUs = EGLANG_SCAN_PERIOD_MS * 1000UL;
+    nextScanUs = micros();
+    resetSchedulerStats();
 }
 
 bool EgLangController::add(const char* rule) {
@@ -52,44 +202,304 @@ bool EgLangController::add(const char* rule) {
     
     if (!rule || count >= MAX_RULES) return false;
     
-    rules[count].setRule(rule);
-    if (rules[count].parsed.valid) {
-        count++;
-        return true;
-    }
+#if EGLANG_ARENA_SIZE > 0
+    // Разбор во временный образ, в арену - только занятая часть
+    RuleImage image;
+    if (!image.parse(rule)) return false;
+    
+    byte size = image.size();
+    if (arenaUsed + size > EGLANG_ARENA_SIZE) return false;
+    
+    RuleImage* record = (RuleImage*)&arena[arenaUsed];
+    memcpy(record, &image, size);
+    if (!attach(record, false)) return false;
+    
+    arenaUsed += size;
+    return true;
+#else
     return false;
+#endif
+}
+
+// Правило, скомпилированное RF()/egCompileRule(): образ остается в PROGMEM
+bool EgLangController::addFlash(const RuleImage* image) {
+    init();
+    
+    if (!image || count >= MAX_RULES) return false;
+    return attach(image, true);
+}
+
+byte EgLangController::addProgram(const RuleImage* program, byte n) {
+    byte added = 0;
+    for (byte i = 0; i < n; i++) {
+        if (addFlash(&program[i])) added++;
+    }
+    return added;
+}
+
+// Подключает образ к следующему дескриптору rules[count]
+bool EgLangController::attach(const RuleImage* image, bool inFlash) {
+    Rule& r = rules[count];
+    if (inFlash) {
+        memcpy_P(&r.header, &image->header, sizeof(r.header));
+    } else {
+        r.header = image->header;
+    }
+    if (!r.header.valid || r.header.length == 0) return false;
+    
+    r.image = image;
+    r.inFlash = inFlash;
+    r.active = false;
+    r.reset();
+#if EGLANG_OPTIMIZE
+    r.sharedTerms = 0;
+    r.sharedAt = 0;
+#endif
+    
+    RuleMask bit = (RuleMask)1 << count;
+    
+    // Индекс зависимостей: какие входы читает правило
+    InputMask reads = r.inputMask();
+    for (byte i = 0; i < INPUT_COUNT; i++) {
+        if ((reads >> i) & 1) dependents[i] |= bit;
+    }
+    
+    // Условное правило с действием HIGH отпускает выход, когда ни одно
+    // правило им больше не владеет. Фронты и таймеры пишут выход сами,
+    // только при смене своего выхода
+    if (r.header.kind == RULE_CONDITIONAL && egLevelOp(r.action().op)) {
+        continuousRules |= bit;
+        Instr action = r.action();
+        if (action.state == 1) {
+            highRules |= bit;
+            releaseOutputs |= (OutputMask)1 << action.index;
+        }
+#if EGLANG_ANALOG
+        if (action.op == OP_PWM) pwmRules |= bit;
+#endif
+    }
+    
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+    // НОВОЕ: аналоговое условие не зависит от снимка входов - проверяется
+    // каждый цикл по последним значениям канала
+    if (r.analogCondition()) {
+        analogRules |= bit;
+        byte channel = (byte)(1 << (r.raw(r.termStart()) & 0x0F));
+        if (!(analogChannels & channel)) {
+            analogChannels |= channel;
+            analog.start(analogChannels);
+        }
+    }
+#endif
+    
+    // Фронт считается от состояния при подключении: условие, уже
+    // выполненное при старте, не срабатывает
+    Instr act = r.action();
+    if (r.header.kind == RULE_CONDITIONAL && (act.op == OP_EDGE || act.op == OP_TOGGLE)) {
+        r.active = r.conditionMet(*this, inputSnapshot);
+    }
+    
+    dirtyRules |= bit;
+    count++;
+    leaveLut(); // Набор правил изменился - таблица устарела
+    return true;
 }
 
 void EgLangController::run() {
-    if (!initialized || count == 0) return;
+    if (!initialized) return;
+    
+    // Новый набор правил вступает в силу только на границе цикла
+    if (pendingRecords) installPending();
+    if (count == 0) return;
+    
+#if EGLANG_STATS
+    stats.scanBegin();
+#endif
+    
+    // Все правила этого цикла видят один и тот же снимок входов
+    sampleInputs();
+    
+    // Проверяем только правила, зависящие от изменившихся входов
+    InputMask changed = inputSnapshot ^ lastSnapshot;
+    lastSnapshot = inputSnapshot;
+    
+    RuleMask dirty = dirtyRules | liveRules | dueTimers();
+#if EGLANG_ANALOG
+    dirty |= analogRules;
+#endif
+    dirtyRules = 0;
+    for (byte i = 0; changed; i++, changed >>= 1) {
+        if (changed & 1) dirty |= dependents[i];
+    }
     
-    // ИЗМЕНЕНО: Проверяем все правила каждый цикл для непрерывных условий
-    bool anyRuleExecuted = false;
+    // Новый кадр выходов
+    frameDrive = 0;
+    frameValue = 0;
+#if EGLANG_ANALOG
+    framePwm = 0;
+#endif
+    
+    // Условные правила только обновляют владельцев выходов при смене условия
+    if (!lutMode) {
+        for (RuleMask m = dirty & continuousRules; m; m &= m - 1) {
+            checkRule(lowestRule(m));
+        }
+    }
     
-    for (byte i = 0; i < count; i++) {
-        if (rules[i].check()) {
-            anyRuleExecuted = true;
+    // Простые команды, фронты, таймеры и циклы пишут в кадр в порядке add();
+    // активный цикл, который не надо проверять, только держит свои выходы
+    for (RuleMask m = (dirty | heldRules) & ~continuousRules; m; m &= m - 1) {
+        byte i = lowestRule(m);
+        requester = i;
+        if ((dirty >> i) & 1) {
+            checkRule(i);
+            updateLive(i);
+        } else {
+            rules[i].hold(*this);
         }
     }
     
+    // Владельцы выходов сводятся с этими записями по номерам правил: одним
+    // поиском в таблице или по владельцам, которые обновляются при смене условий
+    if (lutMode) {
+        mergeLut(lookupLut(inputSnapshot));
+    } else {
+        for (byte i = 0; i < OUTPUT_COUNT; i++) {
+            resolveOutput(owners[i], i, frameDrive, frameValue);
+        }
+    }
+    
+    // Выход правила с действием HIGH, который в этом цикле никто не задал,
+    // отпускается в LOW
+    OutputMask release = releaseOutputs & ~frameDrive;
+    frameDrive |= release;
+    frameValue &= ~release;
+    
+    // Одна запись на каждый изменившийся пин
+    commitFrame();
+    
     // Переходим к следующему правилу только для простых команд
-    if (currentRule < count && rules[currentRule].parsed.isSimpleCommand && rules[currentRule].done) {
+    if (currentRule < count && rules[currentRule].header.kind == RULE_SIMPLE && rules[currentRule].done) {
         currentRule++;
         if (currentRule >= count) {
             currentRule = 0;
             
             // Сброс простых команд
             for (byte i = 0; i < count; i++) {
-                if (rules[i].parsed.isSimpleCommand) {
+                if (rules[i].header.kind == RULE_SIMPLE) {
                     rules[i].reset();
+                    updateLive(i);
                 }
             }
         }
     }
+    
+#if EGLANG_STATS
+    stats.scanEnd();
+#endif
+}
+
+void EgLangController::checkRule(byte i) {
+#if EGLANG_STATS
+    unsigned long start = micros();
+    rules[i].check(*this);
+    stats.ruleChecked(i, micros() - start);
+#else
+    rules[i].check(*this);
+#endif
+}
+
+// Неблокирующий планировщик: цикл запускается по дедлайну micros(),
+// между циклами loop() свободен для кода пользователя
+bool EgLangController::poll() {
+    if (!initialized) return false;
+    
+    unsigned long now = micros();
+    if ((long)(now - nextScanUs) < 0) {
+#if EGLANG_PCINT
+        // Фронт на входе - цикл сразу, вне сетки периода; пока интегратор
+        // антидребезга не дошел до уровня пина - раз в миллисекунду
+        if (inputEvents || (settlingInputs && millis() != lastSampleMs)) {
+            run();
+            return true;
+        }
+#endif
+        return false;
+    }
+    
+    // Дрожание: отклонение фактического периода от заданного
+    if (scans) {
+        jitterLastUs = (long)(now - lastScanUs - scanPeriodUs);
+        unsigned long jitter = (jitterLastUs < 0) ? -jitterLastUs : jitterLastUs;
+        if (jitter > jitterMaxUs) jitterMaxUs = jitter;
+#if EGLANG_STATS
+        stats.jitter(jitter);
+#endif
+    }
+    lastScanUs = now;
+    scans++;
+#if EGLANG_TRACE_STATS_SCANS
+    if (scans % EGLANG_TRACE_STATS_SCANS == 0) {
+        EGLANG_TRACE(*this, 1, TRACE_SCAN_STATS, overruns > 0xFF ? 0xFF : overruns,
+                     jitterMaxUs > 0xFFFF ? 0xFFFF : jitterMaxUs);
+    }
+#endif
+    
+    // Опоздали на целый период - не догоняем пачкой, а сдвигаем сетку
+    nextScanUs += scanPeriodUs;
+    if ((long)(now - nextScanUs) >= 0) {
+        if (overruns < 0xFFFF) overruns++;
+        nextScanUs = now + scanPeriodUs;
+    }
+    
+    run();
+    return true;
+}
+
+// Сон между циклами: фронт на входе будит сразу. Если есть работа по
+// времени (последовательности, таймеры, антидребезг, невыполненные
+// правила) - режим IDLE: millis() идет, и таймер 0 будит каждую
+// миллисекунду. Иначе - POWER_DOWN до прерывания входа
+void EgLangController::sleep() {
+#if EGLANG_PCINT
+    bool timed = liveRules || dirtyRules || settlingInputs || pendingRecords;
+#if EGLANG_ANALOG
+    if (analogRules) timed = true;  // Условия по каналам АЦП проверяются каждый цикл
+#endif
+    for (byte i = 0; i < EGLANG_TIMER_SLOTS && !timed; i++) {
+        if (timerSlots[i]) timed = true;
+    }
+#if EGLANG_TRACE_LEVEL > 0
+    if (!timed) Serial.flush();  // UART в POWER_DOWN останавливается
+#endif
+    set_sleep_mode(timed ? SLEEP_MODE_IDLE : SLEEP_MODE_PWR_DOWN);
+    
+    cli();
+    if (inputEvents) {
+        sei();
+        return;
+    }
+    sleep_enable();
+    sei();                       // Команда после sei выполняется до прерывания:
+    sleep_cpu();                 // фронт между проверкой и сном не теряется
+    sleep_disable();
+#endif
+}
+
+void EgLangController::setScanPeriod(unsigned long ms) {
+    scanPeriodUs = ms * 1000UL;
+    nextScanUs = micros();
+}
+
+void EgLangController::resetSchedulerStats() {
+    scans = 0;
+    overruns = 0;
+    jitterLastUs = 0;
+    jitterMaxUs = 0;
 }
 
 void EgLangController::resetPinsToHighZ() {
-    for (byte i = 0; i < 6; i++) {
+    for (byte i = 0; i < OUTPUT_COUNT; i++) {
         pinMode(pgm_read_byte(&outputs[i]), INPUT);
     }
 }
@@ -99,9 +509,173 @@ void EgLangController::reset() {
     for (byte i = 0; i < count; i++) {
         rules[i].reset();
     }
+    memset(timerSlots, 0, sizeof(timerSlots));
+    
+    // Циклы вышли из состояния inLoop - все правила проверяются заново
+    heldRules = 0;
+    dirtyRules = (count < sizeof(RuleMask) * 8) ? (((RuleMask)1 << count) - 1) : ~(RuleMask)0;
     // Пины сохраняют свое состояние при reset()
 }
 
+// Пустой набор правил (перед загрузкой нового). Пины не трогаем:
+// новые правила примут выходы в текущем состоянии
+void EgLangController::clearRules() {
+    count = 0;
+    currentRule = 0;
+    arenaUsed = 0;
+    
+    memset(owners, 0, sizeof(owners));
+    memset(dependents, 0, sizeof(dependents));
+    highRules = 0;
+    releaseOutputs = 0;
+    continuousRules = 0;
+    liveRules = 0;
+    heldRules = 0;
+    dirtyRules = 0;
+    memset(timerSlots, 0, sizeof(timerSlots));
+#if EGLANG_OPTIMIZE
+    sharedCount = 0;
+    sharedKnown = 0;
+#endif
+#if EGLANG_ANALOG
+    analogRules = 0;
+    pwmRules = 0;
+#if ANALOG_COUNT > 0
+    if (analogChannels) analog.start(0);
+#endif
+    analogChannels = 0;
+#endif
+    
+    lutMode = false;
+    lutFlash = NULL;
+}
+
+bool EgLangController::saveImage(word address) {
+#if EGLANG_EEPROM
+    word size = 0;
+    for (byte i = 0; i < count; i++) size += sizeof(RuleImage::Header) + rules[i].header.length;
+    if ((unsigned long)address + IMAGE_HEADER + size + IMAGE_TRAILER > E2END + 1UL) return false;
+    
+    byte header[IMAGE_HEADER] = {
+        'E', 'g', EGLANG_IMAGE_VERSION, pinSignature(), count, arbitration, (byte)size, (byte)(size >> 8)
+    };
+    
+    // update - пишутся только отличающиеся байты (ресурс EEPROM)
+    ImageChecksum sum = {0, 0};
+    uint8_t* at = (uint8_t*)(uintptr_t)address;
+    for (byte i = 0; i < IMAGE_HEADER; i++) {
+        sum.add(header[i]);
+        eeprom_update_byte(at++, header[i]);
+    }
+    
+    for (byte i = 0; i < count; i++) {
+        Rule& r = rules[i];
+        byte raw[sizeof(RuleImage::Header)];
+        memcpy(raw, &r.header, sizeof(raw));
+        for (byte k = 0; k < sizeof(raw); k++) {
+            sum.add(raw[k]);
+            eeprom_update_byte(at++, raw[k]);
+        }
+        
+        for (byte k = 0; k < r.header.length; k++) {
+            byte raw = r.raw(k);
+            sum.add(raw);
+            eeprom_update_byte(at++, raw);
+        }
+    }
+    
+    eeprom_update_byte(at++, sum.a);
+    eeprom_update_byte(at, sum.b);
+    return true;
+#else
+    (void)address;
+    return false;
+#endif
+}
+
+bool EgLangController::loadImage(word address) {
+#if EGLANG_EEPROM && EGLANG_ARENA_SIZE > 0
+    init();
+    
+    if ((unsigned long)address + IMAGE_HEADER + IMAGE_TRAILER > E2END + 1UL) return false;
+    
+    byte header[IMAGE_HEADER];
+    eeprom_read_block(header, (const void*)(uintptr_t)address, IMAGE_HEADER);
+    if (header[0] != 'E' || header[1] != 'g') return false;
+    if (header[2] != EGLANG_IMAGE_VERSION || header[3] != pinSignature()) return false;
+    
+    byte n = header[4];
+    word size = header[6] | (header[7] << 8);
+    if (n == 0 || n > MAX_RULES || header[5] > ARB_AND || size > EGLANG_ARENA_SIZE) return false;
+    if ((unsigned long)address + IMAGE_HEADER + size + IMAGE_TRAILER > E2END + 1UL) return false;
+    
+    // Проверка до изменения набора: сумма и структура каждой записи
+    ImageChecksum sum = {0, 0};
+    for (byte i = 0; i < IMAGE_HEADER; i++) sum.add(header[i]);
+    
+    const uint8_t* records = (const uint8_t*)(uintptr_t)address + IMAGE_HEADER;
+    word at = 0;
+    byte seen = 0;
+    while (at < size) {
+        RuleImage image;
+        if (at + sizeof(RuleImage::Header) > size) return false;
+        eeprom_read_block(&image.header, records + at, sizeof(RuleImage::Header));
+        if (image.header.length > MAX_RULE_CODE || at + image.size() > size) return false;
+        
+        eeprom_read_block(image.code, records + at + sizeof(RuleImage::Header), image.header.length);
+        if (!image.wellFormed()) return false;
+        
+        for (byte i = 0; i < image.size(); i++) sum.add(eeprom_read_byte(records + at + i));
+        at += image.size();
+        seen++;
+    }
+    if (seen != n) return false;
+    if (eeprom_read_byte(records + size) != sum.a || eeprom_read_byte(records + size + 1) != sum.b) return false;
+    
+    // Образ верный: записи копируются в арену как есть
+    clearRules();
+    arbitration = header[5];
+    eeprom_read_block(arena, records, size);
+    attachArena(size);
+    return true;
+#else
+    (void)address;
+    return false;
+#endif
+}
+
+// Подключает проверенные записи, уже лежащие в начале арены
+void EgLangController::attachArena(word size) {
+#if EGLANG_ARENA_SIZE > 0
+    for (word at = 0; at < size; ) {
+        RuleImage* record = (RuleImage*)&arena[at];
+        at += record->size();
+        attach(record, false);
+    }
+    arenaUsed = size;
+#else
+    (void)size;
+#endif
+}
+
+bool EgLangController::stage(const byte* records, word size, byte n) {
+    if (!records || n == 0 || n > MAX_RULES || size > EGLANG_ARENA_SIZE) return false;
+    
+    pendingRecords = records;
+    pendingSize = size;
+    return true;
+}
+
+// Замена набора между циклами: копия записей и подключение, без разбора
+void EgLangController::installPending() {
+#if EGLANG_ARENA_SIZE > 0
+    clearRules();
+    memcpy(arena, pendingRecords, pendingSize);
+    attachArena(pendingSize);
+#endif
+    pendingRecords = NULL;
+}
+
 // НОВЫЙ МЕТОД: Завершение работы с полным сбросом пинов
 void EgLangController::shutdown() {
     // Сбрасываем все правила
@@ -111,91 +685,484 @@ void EgLangController::shutdown() {
     resetPinsToHighZ();
     
     // Очищаем состояния пинов
-    for (byte i = 0; i < 6; i++) {
-        pinStates[i].state = 0;
-        pinStates[i].isOutput = 0;
-    }
+    outputState = 0;
+    outputDriven = 0;
+#if EGLANG_ANALOG
+    outputPwm = 0;
+#endif
     
-    Serial.println("EgLang shutdown complete");
+    EGLANG_TRACE(*this, 1, TRACE_SHUTDOWN, 0, 0);
 }
 
 // НОВЫЕ МЕТОДЫ: Управление состояниями пинов
-void EgLangController::updatePinState(byte pin, byte state) {
-    for (byte i = 0; i < 6; i++) {
-        if (pinStates[i].pin == pin) {
-            pinStates[i].state = state;
-            pinStates[i].isOutput = 1;
-            break;
+void EgLangController::setPinOutput(byte pin, byte state) {
+    for (byte i = 0; i < OUTPUT_COUNT; i++) {
+        if (pgm_read_byte(&outputs[i]) == pin) {
+            setOutput(i, state);
+            return;
         }
     }
 }
 
-void EgLangController::setPinOutput(byte pin, byte state) {
+bool EgLangController::setOutput(byte index, byte state) {
+    OutputMask bit = (OutputMask)1 << index;
+    OutputMask settled = outputDriven;
+#if EGLANG_ANALOG
+    settled &= ~outputPwm;           // Выход в ШИМ не равен ни 0, ни 1
+#endif
+    
     // ИСПРАВЛЕНИЕ: Строгая проверка - избегаем ЛЮБЫХ повторных вызовов
-    for (byte i = 0; i < 6; i++) {
-        if (pinStates[i].pin == pin) {
-            if (pinStates[i].isOutput && pinStates[i].state == state) {
-                // ПОЛНОСТЬЮ ИГНОРИРУЕМ повторную установку того же состояния
-                return;
-            }
-            break;
+    if ((settled & bit) && ((outputState >> index) & 1) == state) return false;
+    
+    // Устанавливаем пин только если состояние ДЕЙСТВИТЕЛЬНО изменилось
+#if EGLANG_ANALOG
+    if (outputPwm & bit) {
+        // Выход из ШИМ - через digitalWrite(), который отключает таймер
+        outputPwm &= ~bit;
+        digitalWrite(pgm_read_byte(&outputs[index]), state);
+    } else {
+        egWriteOutputs(bit, state ? bit : 0);
+    }
+#else
+    egWriteOutputs(bit, state ? bit : 0);
+#endif
+    if (state) outputState |= bit; else outputState &= ~bit;
+    outputDriven |= bit;
+    
+    // ОТЛАДКА: Записываем только реальные изменения
+    EGLANG_TRACE(*this, 1, TRACE_PIN_CHANGE, pgm_read_byte(&outputs[index]), state);
+    EGLANG_STATS_WRITE(*this);
+    return true;
+}
+
+void EgLangController::request(byte index, byte state) {
+    // Правило, чья запись выигрывает: последнее при ARB_LAST, первое иначе
+    if (arbitration == ARB_LAST || !((frameDrive >> index) & 1)) frameRule[index] = requester;
+#if EGLANG_ANALOG
+    // Выход уже в ШИМ в этом кадре - запись как скважность 0 или 255
+    if ((framePwm >> index) & 1) {
+        combineDuty(index, state ? 255 : 0, arbitration);
+        return;
+    }
+#endif
+    combineWrite(frameDrive, frameValue, (OutputMask)1 << index, state, arbitration);
+}
+
+void EgLangController::requestDuty(byte index, byte duty) {
+#if EGLANG_ANALOG
+    if (arbitration == ARB_LAST || !((frameDrive >> index) & 1)) frameRule[index] = requester;
+    combineDuty(index, duty, arbitration);
+#else
+    request(index, duty != 0);
+#endif
+}
+
+word EgLangController::analogValue(byte channel) const {
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+    return channel < ANALOG_COUNT ? analog.read(channel) : 0;
+#else
+    (void)channel;
+    return 0;
+#endif
+}
+
+#if EGLANG_ANALOG
+// Скважность в кадр по политике. Цифровая запись - скважность 0 или 255,
+// поэтому политики те же: последняя, первая, максимум (ИЛИ), минимум (И)
+void EgLangController::combineDuty(byte index, byte duty, byte policy) {
+    OutputMask bit = (OutputMask)1 << index;
+    if (frameDrive & bit) {
+        byte old = (framePwm & bit) ? frameDuty[index] : ((frameValue & bit) ? 255 : 0);
+        switch (policy) {
+            case ARB_PRIORITY:
+                duty = old;
+                break;
+            case ARB_OR:
+                if (old > duty) duty = old;
+                break;
+            case ARB_AND:
+                if (old < duty) duty = old;
+                break;
         }
     }
     
-    // Устанавливаем пин только если состояние ДЕЙСТВИТЕЛЬНО изменилось
-    pinMode(pin, OUTPUT);
-    digitalWrite(pin, state);
-    updatePinState(pin, state);
-    
-    // ОТЛАДКА: Показываем только реальные изменения
-    Serial.print("CHANGE Pin "); Serial.print(pin); 
-    Serial.print(" -> "); Serial.println(state);
-}
-
-// НОВЫЙ МЕТОД: Проверка и сброс неактивных пинов
-void EgLangController::checkAndResetInactivePins() {
-    // Проверяем каждый активный пин
-    for (byte i = 0; i < 6; i++) {
-        if (pinStates[i].isOutput) {
-            byte pin = pinStates[i].pin;
-            bool shouldBeActive = false;
-            
-            // Проверяем есть ли активные условные правила для этого пина
-            for (byte j = 0; j < count; j++) {
-                if (rules[j].parsed.valid && !rules[j].parsed.isSimpleCommand && 
-                    !rules[j].parsed.isLoop && rules[j].parsed.action == pin) {
-                    
-                    // Проверяем условие
-                    bool condition1 = (readPinStable(rules[j].parsed.trigger1) == (rules[j].parsed.tState1 == 1));
-                    bool condition2 = true;
-                    
-                    if (rules[j].parsed.useAND) {
-                        condition2 = (readPinStable(rules[j].parsed.trigger2) == (rules[j].parsed.tState2 == 1));
-                    }
-                    
-                    if (condition1 && condition2) {
-                        shouldBeActive = true;
-                        break;
-                    }
-                }
-            }
-            
-            // Если пин не должен быть активным, сбрасываем его
-            if (!shouldBeActive && pinStates[i].state == 1) {
-                setPinOutput(pin, 0);
+    frameDrive |= bit;
+    if (duty) frameValue |= bit; else frameValue &= ~bit;
+    if (duty != 0 && duty != 255) framePwm |= bit; else framePwm &= ~bit;
+    frameDuty[index] = duty;
+}
+
+// Скважность выхода по владельцам с действием HIGH или ШИМ: то же правило,
+// что выбирает resolveOutput() - старшее, младшее, максимум или минимум
+byte EgLangController::ownerDuty(RuleMask high) {
+    if (arbitration == ARB_LAST || arbitration == ARB_PRIORITY) {
+        Rule& r = rules[arbitration == ARB_LAST ? highestRule(high) : lowestRule(high)];
+        return r.action().op == OP_PWM ? r.duty() : 255;
+    }
+    
+    byte duty = (arbitration == ARB_OR) ? 0 : 255;
+    for (RuleMask m = high; m; m &= m - 1) {
+        Rule& r = rules[lowestRule(m)];
+        byte d = r.action().op == OP_PWM ? r.duty() : 255;
+        if (arbitration == ARB_OR ? d > duty : d < duty) duty = d;
+    }
+    return duty;
+}
+
+// Выходы кадра в ШИМ и выходы, покидающие ШИМ: analogWrite() только при
+// смене скважности, выход из ШИМ - digitalWrite(), который отключает таймер.
+// Возвращает выходы, уже записанные здесь
+OutputMask EgLangController::commitPwm() {
+    OutputMask handled = frameDrive & (framePwm | outputPwm);
+    for (byte i = 0; i < OUTPUT_COUNT; i++) {
+        OutputMask bit = (OutputMask)1 << i;
+        if (!(handled & bit)) continue;
+        
+        byte pin = pgm_read_byte(&outputs[i]);
+        byte value;
+        if (framePwm & bit) {
+            if ((outputPwm & bit) && outputDuty[i] == frameDuty[i]) continue;
+            value = frameDuty[i];
+            analogWrite(pin, value);
+            outputPwm |= bit;
+            outputDuty[i] = value;
+            outputState |= bit;
+        } else {
+            value = (frameValue >> i) & 1;
+            digitalWrite(pin, value);
+            outputPwm &= ~bit;
+            if (value) outputState |= bit; else outputState &= ~bit;
+        }
+        outputDriven |= bit;
+        
+        EGLANG_TRACE(*this, 1, TRACE_PIN_CHANGE, pin, value);
+        EGLANG_STATS_WRITE(*this);
+    }
+    return handled;
+}
+#endif
+
+void EgLangController::setArbitration(byte policy) {
+    arbitration = policy;
+    leaveLut(); // Таблица построена для прежней политики
+}
+
+// Выход из режима LUT: владельцы выходов в нем не обновлялись,
+// поэтому все условные правила проверяются заново
+void EgLangController::leaveLut() {
+    if (!lutMode) return;
+    lutMode = false;
+    dirtyRules |= continuousRules;
+}
+
+// Записывает отличия кадра от outputState операциями над масками целиком:
+// изменились выходы кадра, еще не настроенные как OUTPUT или с другим значением
+void EgLangController::commitFrame() {
+    OutputMask changed = frameDrive & (~outputDriven | (outputState ^ frameValue));
+#if EGLANG_ANALOG
+    if (framePwm | outputPwm) changed &= ~commitPwm();
+#endif
+    if (!changed) return;
+    
+#if EGLANG_TRACE_LEVEL > 0 || EGLANG_STATS
+    for (byte i = 0; i < OUTPUT_COUNT; i++) {
+        if (!((changed >> i) & 1)) continue;
+        EGLANG_TRACE(*this, 1, TRACE_PIN_CHANGE, pgm_read_byte(&outputs[i]), (frameValue >> i) & 1);
+        EGLANG_STATS_WRITE(*this);
+    }
+#endif
+    
+    outputState = (outputState & ~changed) | (frameValue & changed);
+    outputDriven |= changed;
+    egWriteOutputs(changed, frameValue);
+}
+
+byte EgLangController::drainTrace() {
+#if EGLANG_TRACE_LEVEL > 0
+    return trace.drainSerial();
+#else
+    return 0;
+#endif
+}
+
+byte EgLangController::drainTrace(Print& out, byte maxEvents) {
+#if EGLANG_TRACE_LEVEL > 0
+    return trace.drain(out, maxEvents);
+#else
+    (void)out; (void)maxEvents;
+    return 0;
+#endif
+}
+
+void EgLangController::dumpStats(Print& out) {
+#if EGLANG_STATS
+    stats.dump(out, count);
+#else
+    (void)out;
+#endif
+}
+
+void EgLangController::resetStats() {
+#if EGLANG_STATS
+    stats.clear();
+#endif
+}
+
+// Правило проверяется каждый цикл, пока простая команда не выполнена
+// или последовательность активна; активный цикл держит выходы в каждом кадре
+void EgLangController::updateLive(byte rule) {
+    Rule& r = rules[rule];
+    RuleMask bit = (RuleMask)1 << rule;
+    bool loop = r.header.kind == RULE_LOOP || r.header.kind == RULE_SEQUENCE;
+    bool live = (r.header.kind == RULE_SIMPLE) ? !r.done : r.inLoop && r.header.kind == RULE_SEQUENCE;
+    if (live) liveRules |= bit; else liveRules &= ~bit;
+    if (loop && r.inLoop) heldRules |= bit; else heldRules &= ~bit;
+}
+
+// Слот тика, в котором истекает таймер
+void EgLangController::armTimer(byte rule, word duration) {
+    unsigned long tick = (lastSampleMs + duration) / EGLANG_TIMER_TICK_MS;
+    timerSlots[tick % EGLANG_TIMER_SLOTS] |= (RuleMask)1 << rule;
+}
+
+void EgLangController::cancelTimer(byte rule) {
+    RuleMask keep = ~((RuleMask)1 << rule);
+    for (byte i = 0; i < EGLANG_TIMER_SLOTS; i++) timerSlots[i] &= keep;
+}
+
+// Правила из слотов тиков от прошлого цикла до текущего включительно:
+// текущий тик просматривается каждый цикл, пока не пройдет, поэтому таймер
+// срабатывает в первом цикле после срока. Правило остается в слоте, пока
+// его таймер не истек или не отменен (таймер длиннее оборота колеса)
+RuleMask EgLangController::dueTimers() {
+    word tick = lastSampleMs / EGLANG_TIMER_TICK_MS;
+    word visit = tick - timerTick + 1;
+    if (visit > EGLANG_TIMER_SLOTS) visit = EGLANG_TIMER_SLOTS;
+    
+    RuleMask due = 0;
+    for (word k = 0; k < visit; k++) {
+        due |= timerSlots[(tick - k) % EGLANG_TIMER_SLOTS];
+    }
+    timerTick = tick;
+    return due;
+}
+
+// Смена условия правила: O(1) обновление владельцев выхода
+void EgLangController::updateOwner(byte rule, byte index, bool active) {
+    RuleMask bit = (RuleMask)1 << rule;
+    if (active) owners[index] |= bit; else owners[index] &= ~bit;
+}
+
+// Состояние выхода по владельцам и политике арбитража. Если выход в этом
+// цикле уже задали правила других видов, записи сводятся по номерам
+// правил: при ARB_LAST побеждает старший, при ARB_PRIORITY - младший
+// (frameRule), ИЛИ и И объединяют все. Без владельцев выход не трогается -
+// отпускание в LOW делает run() после всех записей
+void EgLangController::resolveOutput(RuleMask active, byte index, OutputMask& drive, OutputMask& value) {
+    if (!active) return;
+    
+    OutputMask bit = (OutputMask)1 << index;
+    byte policy = ARB_LAST;          // Владельцы задают выход целиком
+    if (drive & bit) {
+        switch (arbitration) {
+            case ARB_LAST:
+                if (highestRule(active) < frameRule[index]) return;
+                break;
+            case ARB_PRIORITY:
+                if (lowestRule(active) > frameRule[index]) return;
+                break;
+            default:
+                policy = arbitration;
+                break;
+        }
+    }
+    
+    RuleMask high = active & highRules;
+    RuleMask low = active & ~highRules;
+    byte state;
+    
+    switch (arbitration) {
+        case ARB_PRIORITY:
+            state = ((active & (~active + 1)) & high) != 0; // Младший бит
+            break;
+        case ARB_OR:
+            state = (high != 0);
+            break;
+        case ARB_AND:
+            state = (low == 0);
+            break;
+        default:
+            state = (high > low);                            // Старший бит
+            break;
+    }
+#if EGLANG_ANALOG
+    // НОВОЕ: выход держит правило с ШИМ - скважность победителя
+    if (state && (high & pwmRules)) {
+        combineDuty(index, ownerDuty(high), policy);
+        return;
+    }
+    // Выход уже в ШИМ в этом кадре - состояние как скважность 0 или 255
+    if ((drive & bit) && (framePwm & bit)) {
+        combineDuty(index, state ? 255 : 0, policy);
+        return;
+    }
+#endif
+    combineWrite(drive, value, bit, state, policy);
+}
+
+// Запись таблицы в кадр. Выходы, которые уже задали правила других видов,
+// сводятся по номерам правил: их владельцы в режиме LUT не хранятся и
+// ищутся заново, только для таких выходов
+void EgLangController::mergeLut(LutEntry e) {
+    OutputMask shared = e.drive & frameDrive;
+    OutputMask own = e.drive & ~shared;
+    frameValue = (frameValue & ~own) | (e.value & own);
+    frameDrive |= own;
+    
+    for (byte i = 0; shared; i++, shared >>= 1) {
+        if (!(shared & 1)) continue;
+        RuleMask active = 0;
+        for (RuleMask m = continuousRules; m; m &= m - 1) {
+            byte k = lowestRule(m);
+            if (rules[k].action().index == i && rules[k].conditionMet(*this, inputSnapshot)) {
+                active |= (RuleMask)1 << k;
             }
         }
+        resolveOutput(active, i, frameDrive, frameValue);
     }
 }
 
-// Вспомогательная функция для стабильного чтения (перенесена из Rule)
+// Запись LUT для снимка входов: те же владельцы и арбитраж, что и в run()
+LutEntry EgLangController::evaluateLut(InputMask snapshot) {
+    RuleMask active[OUTPUT_COUNT];
+    memset(active, 0, sizeof(active));
+    
+    for (byte i = 0; i < count; i++) {
+        if (!((continuousRules >> i) & 1)) continue;
+        
+        Rule& r = rules[i];
+        if (r.conditionMet(*this, snapshot)) {
+            active[r.action().index] |= (RuleMask)1 << i;
+        }
+    }
+    
+    LutEntry e = {0, 0};
+    for (byte i = 0; i < OUTPUT_COUNT; i++) {
+        resolveOutput(active[i], i, e.drive, e.value);
+    }
+    return e;
+}
+
+bool EgLangController::compileLut() {
+#if EGLANG_LUT
+#if EGLANG_ANALOG
+    // Таблица - только по снимку входов: без каналов АЦП и скважностей
+    if (analogRules | pwmRules) return false;
+#endif
+    for (word v = 0; v < LUT_SIZE; v++) {
+        lut[v] = evaluateLut(v);
+    }
+    lutFlash = NULL;
+    lutMode = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool EgLangController::useLut(const LutEntry* table) {
+    if (!table || LUT_SIZE == 0) return false;
+#if EGLANG_ANALOG
+    if (analogRules | pwmRules) return false;
+#endif
+    lutFlash = table;
+    lutMode = true;
+    return true;
+}
+
+LutEntry EgLangController::lookupLut(InputMask snapshot) {
+    if (lutFlash) {
+        LutEntry e;
+        memcpy_P(&e, &lutFlash[snapshot], sizeof(e));
+        return e;
+    }
+#if EGLANG_LUT
+    return lut[snapshot];
+#else
+    LutEntry e = {0, 0};
+    return e;
+#endif
+}
+
+// Печать таблицы в виде инициализатора для const LutEntry table[] PROGMEM
+void EgLangController::printLut(Print& out) {
+#if LUT_SIZE > 0
+    for (word v = 0; v < LUT_SIZE; v++) {
+        LutEntry e = evaluateLut(v);
+        out.print("{0x"); out.print((unsigned long)e.value, HEX);
+        out.print(", 0x"); out.print((unsigned long)e.drive, HEX);
+        out.println("},");
+    }
+#else
+    (void)out;
+#endif
+}
+
+// Стабильное состояние пина (true = LOW) из снимка текущего цикла
 bool EgLangController::readPinStable(byte pin) {
-    byte readings = 0;
-    for (byte i = 0; i < 3; i++) {
-        if (digitalRead(pin) == LOW) readings++;
-        delayMicroseconds(100);
+    for (byte i = 0; i < INPUT_COUNT; i++) {
+        if (pgm_read_byte(&inputs[i]) == pin) {
+            return (inputSnapshot >> i) & 1;
+        }
+    }
+    return false;
+}
+
+// Одна выборка всех входов без ожидания. Антидребезг - интегратор на пин:
+// уровень сдвигается на прошедшее время к 0 или к EGLANG_DEBOUNCE_MS,
+// стабильное состояние меняется только на границах окна
+void EgLangController::sampleInputs() {
+    unsigned long now = millis();
+    unsigned long elapsed = now - lastSampleMs;
+    lastSampleMs = now;
+    
+    // Шаг не больше половины окна - одиночная выборка не переключит вход
+    const byte maxStep = (EGLANG_DEBOUNCE_MS + 1) / 2;
+    byte step = (elapsed > maxStep) ? maxStep : (byte)elapsed;
+    
+#if EGLANG_PCINT
+    // События до этой выборки учтены; фронт после нее снова разбудит цикл
+    inputEvents = 0;
+#endif
+    InputMask raw = egReadInputs();
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+    if (analogChannels) analog.poll();
+#endif
+    settlingInputs = 0;
+    if (EGLANG_DEBOUNCE_MS == 0) {
+        inputSnapshot = raw;
+        return;
+    }
+    
+    for (byte i = 0; i < INPUT_COUNT; i++) {
+        bool low = (raw >> i) & 1;
+        InputMask mask = (InputMask)1 << i;
+        
+        byte level = debounce[i];
+        if (low) {
+            level = (level + step >= EGLANG_DEBOUNCE_MS) ? EGLANG_DEBOUNCE_MS : level + step;
+        } else {
+            level = (level <= step) ? 0 : level - step;
+        }
+        debounce[i] = level;
+        
+        if (level == EGLANG_DEBOUNCE_MS) {
+            inputSnapshot |= mask;
+        } else if (level == 0) {
+            inputSnapshot &= ~mask;
+        }
+        if (level != (low ? EGLANG_DEBOUNCE_MS : 0)) settlingInputs |= mask;
     }
-    return (readings >= 2);
 }
 
 // Глобальные функции-обёртки
@@ -207,110 +1174,192 @@ void processRules() {
     _eglang.run();
 }
 
+bool pollRules() {
+    return _eglang.poll();
+}
+
 // НОВАЯ ФУНКЦИЯ: Завершение работы EgLang
 void shutdownEgLang() {
     _eglang.shutdown();
 }
 
-// Методы Rule с исправленными багами
-void Rule::parseRule() {
-    memset(&parsed, 0, sizeof(parsed));
-    parsed.valid = false;
+// Разбор текста правила в образ (методы с исправленными багами)
+bool RuleImage::parse(const char* text) {
+    memset(&header, 0, sizeof(header));
+    header.valid = false;
     
-    if (!ruleText[0]) return;
+    if (!text || !text[0]) return false; // БАГ-ФИХ: Проверка пустой строки
     
-    byte len = strlen(ruleText);
-    if (len < 3) return; // Минимум "2,1"
+    size_t len = strlen(text);
+    if (len < 3) return false; // Минимум "2,1"
+    if (len >= MAX_RULE_LENGTH) return false;
     
-    if (ruleText[0] == '[' && ruleText[len-1] == ']') {
-        parseLoop();
-    } else if (ruleText[0] == '?') {
-        parseConditionalRule();
+    if (text[0] == '[' && text[len-1] == ']') {
+        parseLoop(text, len);
+    } else if (text[0] == '?' || text[0] == '^') {
+        parseConditionalRule(text);
     } else {
-        parseSimpleCommand();
+        parseSimpleCommand(text);
     }
+    
+    if (!header.valid) header.length = 0;
+    return header.valid;
 }
 
-void Rule::parseLoop() {
+// Добавляет инструкцию в code[] (INSTR_SIZE байт, младшим вперед)
+bool RuleImage::emit(byte op, byte index, byte state) {
+    InstrCode in = egEncode(op, state, index);
+    for (byte b = 0; b < INSTR_SIZE; b++) {
+        if (!emitByte((byte)(in >> (8 * b)))) return false;
+    }
+    return true;
+}
+
+// Маска терма: MASK_SIZE байт, младшим вперед
+bool RuleImage::emitMask(InputMask mask) {
+    for (byte b = 0; b < MASK_SIZE; b++) {
+        if (!emitByte((byte)(mask >> (8 * b)))) return false;
+    }
+    return true;
+}
+
+bool RuleImage::emitByte(byte value) {
+    if (header.length >= MAX_RULE_CODE) return false;
+    
+    code[header.length++] = value;
+    return true;
+}
+
+void RuleImage::parseLoop(const char* text, byte len) {
     // БАГ-ФИХ: Более строгая проверка формата [pin:commands]
-    byte len = strlen(ruleText);
     if (len < 5) return; // Минимум "[3:4]"
     
     // Ищем двоеточие
-    char* colon = strchr(ruleText + 1, ':');
-    if (!colon || colon >= ruleText + len - 2) return; // Должно быть место для команд
+    const char* colon = strchr(text + 1, ':');
+    if (!colon || colon >= text + len - 2) return; // Должно быть место для команд
     
     // Извлекаем пин (максимум 2 цифры)
-    int pinLen = colon - (ruleText + 1);
+    int pinLen = colon - (text + 1);
     if (pinLen <= 0 || pinLen > 2) return;
     
     char pinStr[4];
-    strncpy(pinStr, ruleText + 1, pinLen);
+    strncpy(pinStr, text + 1, pinLen);
     pinStr[pinLen] = '\0';
     
     int pin = atoi(pinStr);
     if (!isPinValid(pin)) return;
     
     // БАГ-ФИХ: Проверяем что пин является INPUT пином
-    if (!isInputPin(pin)) return;
+    byte index = inputIndex(pin);
+    if (index == 0xFF) return;
     
     // Извлекаем команды (между : и ])
-    int cmdLen = (ruleText + len - 1) - (colon + 1);
+    int cmdLen = (text + len - 1) - (colon + 1);
     if (cmdLen <= 0 || cmdLen >= MAX_LOOP_COMMANDS) return;
     
-    strncpy(parsed.loopCommands, colon + 1, cmdLen);
-    parsed.loopCommands[cmdLen] = '\0';
+    char commands[MAX_LOOP_COMMANDS];
+    strncpy(commands, colon + 1, cmdLen);
+    commands[cmdLen] = '\0';
+    
+    emit(OP_LOOP, index, 1);
     
-    // БАГ-ФИХ: Валидируем каждую команду в цикле
-    if (!validateLoopCommands(parsed.loopCommands)) return;
+    // НОВОЕ: хотя бы одна длительность "@мс" - последовательность шагов
+    bool timed = strchr(commands, '@') != NULL;
     
-    parsed.loopPin = pin;
-    parsed.isLoop = true;
-    parsed.valid = true;
+    // БАГ-ФИХ: Валидируем и декодируем каждую команду в цикле
+    if (!parseLoopCommands(commands, timed)) return;
+    if (timed && (header.length - INSTR_SIZE) / STEP_SIZE > MAX_SEQUENCE_STEPS) return;
+    
+    header.isAlternating = timed ? false : detectAlternating();
+    header.kind = timed ? RULE_SEQUENCE : RULE_LOOP;
+    header.valid = true;
 }
 
-void Rule::parseSimpleCommand() {
-    char* comma = strchr(ruleText, ',');
-    if (!comma || comma == ruleText) return;
+// Длительность шага или таймера: 1-5 цифр, не больше 65535 мс
+static bool parseDuration(const char* text, word& ms) {
+    byte digits = 0;
+    unsigned long value = 0;
+    for (; egIsDigit(*text); text++) {
+        if (++digits > 5) return false;
+        value = value * 10 + (*text - '0');
+    }
+    if (digits == 0 || *text || value > 0xFFFF) return false;
     
-    // БАГ-ФИХ: Проверяем что есть символы после запятой
-    if (!*(comma + 1) || *(comma + 2) != '\0') return; // Только один символ после запятой
+    ms = (word)value;
+    return true;
+}
+
+// НОВОЕ: скважность ШИМ "=D" - 0-255, цифры как у длительности
+static bool parseDuty(const char* text, byte& duty) {
+    word value;
+    if (*text != '=' || !parseDuration(text + 1, value) || value > 255) return false;
+    
+    duty = (byte)value;
+    return true;
+}
+
+void RuleImage::parseSimpleCommand(const char* text) {
+    const char* comma = strchr(text, ',');
+    if (!comma || comma == text) return;
+    
+    // НОВОЕ: "P,=D" - скважность ШИМ (EGLANG_ANALOG)
+    bool pwm = EGLANG_ANALOG && *(comma + 1) == '=';
+    byte duty = 0;
+    if (pwm) {
+        if (!parseDuty(comma + 1, duty)) return;
+    } else {
+        // БАГ-ФИХ: Проверяем что есть символы после запятой
+        if (!*(comma + 1) || *(comma + 2) != '\0') return; // Только один символ после запятой
+    }
     
     // Извлекаем пин
-    int pinLen = comma - ruleText;
+    int pinLen = comma - text;
     if (pinLen <= 0 || pinLen > 2) return;
     
     char pinStr[4];
-    strncpy(pinStr, ruleText, pinLen);
+    strncpy(pinStr, text, pinLen);
     pinStr[pinLen] = '\0';
     
     int pin = atoi(pinStr);
     if (!isPinValid(pin)) return;
     
     // БАГ-ФИХ: Проверяем что пин является OUTPUT пином
-    if (!isOutputPin(pin)) return;
+    byte index = outputIndex(pin);
+    if (index == 0xFF) return;
     
-    // БАГ-ФИХ: Проверяем состояние (только '0' или '1')
-    char stateChar = *(comma + 1);
-    if (stateChar != '0' && stateChar != '1') return;
-    
-    parsed.action = pin;
-    parsed.aState = (stateChar == '1') ? 1 : 0;
-    parsed.isSimpleCommand = true;
-    parsed.valid = true;
+    if (pwm) {
+        if (!egPwmOutput(index)) return;
+        emit(OP_PWM, index, duty != 0);
+        emitByte(duty);
+    } else {
+        // БАГ-ФИХ: Проверяем состояние (только '0' или '1')
+        char stateChar = *(comma + 1);
+        if (stateChar != '0' && stateChar != '1') return;
+        
+        emit(OP_SET, index, (stateChar == '1') ? 1 : 0);
+    }
+    header.kind = RULE_SIMPLE;
+    header.valid = true;
 }
 
-void Rule::parseConditionalRule() {
-    char* exclamation = strchr(ruleText, '!');
-    if (!exclamation || exclamation <= ruleText + 1) return;
+void RuleImage::parseConditionalRule(const char* text) {
+    const char* exclamation = strchr(text, '!');
+    if (!exclamation || exclamation <= text + 1) return;
     
     // Парсим действие после !
-    char* actionStart = exclamation + 1;
-    char* actionComma = strchr(actionStart, ',');
+    const char* actionStart = exclamation + 1;
+    const char* actionComma = strchr(actionStart, ',');
     if (!actionComma || actionComma == actionStart) return;
     
     // БАГ-ФИХ: Проверяем что после запятой только один символ (состояние)
-    if (!*(actionComma + 1) || *(actionComma + 2) != '\0') return;
+    // НОВОЕ: или "=D" - скважность ШИМ (EGLANG_ANALOG)
+    bool pwm = EGLANG_ANALOG && *(actionComma + 1) == '=';
+    byte duty = 0;
+    if (pwm) {
+        if (!parseDuty(actionComma + 1, duty)) return;
+    } else if (!*(actionComma + 1) || *(actionComma + 2) != '\0') {
+        return;
+    }
     
     // Извлекаем пин действия
     int actionPinLen = actionComma - actionStart;
@@ -321,60 +1370,83 @@ void Rule::parseConditionalRule() {
     actionPinStr[actionPinLen] = '\0';
     
     int actionPin = atoi(actionPinStr);
-    if (!isPinValid(actionPin) || !isOutputPin(actionPin)) return;
+    if (!isPinValid(actionPin)) return;
+    byte actionIndex = outputIndex(actionPin);
+    if (actionIndex == 0xFF) return;
     
+    // НОВОЕ: "^" - правило по фронту условия; у него действие "P,~" переключает выход
+    bool edge = (text[0] == '^');
     char actionStateChar = *(actionComma + 1);
-    if (actionStateChar != '0' && actionStateChar != '1') return;
-    
-    parsed.action = actionPin;
-    parsed.aState = (actionStateChar == '1') ? 1 : 0;
-    
-    // НОВОЕ: Условные правила теперь непрерывные
-    parsed.isContinuous = true;
-    
-    // Парсим условие (от ? до !)
-    int conditionLen = exclamation - (ruleText + 1);
-    if (conditionLen <= 0 || conditionLen > 15) return; // Ограничиваем длину условия
+    bool toggle = edge && actionStateChar == '~';
+    if (pwm) {
+        // ШИМ держит выход, пока выполнено условие: без фронта и таймера
+        if (edge || !egPwmOutput(actionIndex)) return;
+    } else if (actionStateChar != '0' && actionStateChar != '1' && !toggle) {
+        return;
+    }
     
-    char condition[16];
-    strncpy(condition, ruleText + 1, conditionLen);
-    condition[conditionLen] = '\0';
+    // НОВОЕ: таймер после условия: +мс - задержка включения, -мс - задержка
+    // выключения, *мс - импульс
+    byte op = edge ? (toggle ? OP_TOGGLE : OP_EDGE) : (pwm ? OP_PWM : OP_SET);
+    const char* conditionEnd = exclamation;
+    word duration = 0;
+    const char* mark = edge ? NULL : strpbrk(text + 1, "+-*");
+    if (mark && mark < exclamation) {
+        if (pwm) return;
+        op = (*mark == '+') ? OP_TON : (*mark == '-') ? OP_TOF : OP_PULSE;
+        
+        char digits[6];
+        byte digitsLen = exclamation - (mark + 1);
+        if (digitsLen > 5) return;
+        strncpy(digits, mark + 1, digitsLen);
+        digits[digitsLen] = '\0';
+        if (!parseDuration(digits, duration)) return;
+        conditionEnd = mark;
+    }
     
-    // Проверяем наличие &
-    char* ampersand = strchr(condition, '&');
-    if (ampersand) {
-        // AND условие
-        if (!parseAndCondition(condition, ampersand)) return;
-    } else {
-        // Простое условие
-        if (!parseSimpleCondition(condition)) return;
+    // Действие - первая инструкция, у таймера за ним длительность, у ШИМ
+    // скважность, затем термы условия (от ? до таймера или !)
+    emit(op, actionIndex, pwm ? (duty != 0) : (actionStateChar == '1'));
+    if (egTimerOp(op)) {
+        emitByte(duration & 0xFF);
+        emitByte(duration >> 8);
     }
+    if (pwm) emitByte(duty);
     
-    parsed.valid = true;
+    // НОВОЕ: "An>порог" - условие по каналу АЦП вместо выражения
+    const char* condition = text + 1;
+    byte conditionLen = conditionEnd - condition;
+    bool parsed = (*condition == 'A') ? parseAnalog(condition, conditionLen) : parseCondition(condition, conditionLen);
+    if (!parsed) return;
+    
+    // НОВОЕ: Условные правила теперь непрерывные
+    header.kind = RULE_CONDITIONAL;
+    header.valid = true;
 }
 
-// БАГ-ФИХ: Новая функция для валидации INPUT пинов
-bool Rule::isInputPin(byte pin) {
-    for (byte i = 0; i < 6; i++) {
-        if (pgm_read_byte(&inputs[i]) == pin) return true;
+// Индекс пина в inputs[] или 0xFF, если пин не INPUT
+byte RuleImage::inputIndex(byte pin) {
+    for (byte i = 0; i < INPUT_COUNT; i++) {
+        if (pgm_read_byte(&inputs[i]) == pin) return i;
     }
-    return false;
+    return 0xFF;
 }
 
-// БАГ-ФИХ: Новая функция для валидации OUTPUT пинов
-bool Rule::isOutputPin(byte pin) {
-    for (byte i = 0; i < 6; i++) {
-        if (pgm_read_byte(&outputs[i]) == pin) return true;
+// Индекс пина в outputs[] или 0xFF, если пин не OUTPUT
+byte RuleImage::outputIndex(byte pin) {
+    for (byte i = 0; i < OUTPUT_COUNT; i++) {
+        if (pgm_read_byte(&outputs[i]) == pin) return i;
     }
-    return false;
+    return 0xFF;
 }
 
-bool Rule::isPinValid(byte pin) {
-    return (pin >= 2 && pin <= 13);
+// Пины 0-1 - Serial; верхняя граница - списки пинов профиля
+bool RuleImage::isPinValid(byte pin) {
+    return pin >= 2;
 }
 
-// БАГ-ФИХ: Новая функция для валидации команд в цикле
-bool Rule::validateLoopCommands(const char* commands) {
+// БАГ-ФИХ: Валидация и декодирование команд цикла в OP_SET
+bool RuleImage::parseLoopCommands(const char* commands, bool timed) {
     if (!commands || !*commands) return false;
     
     char temp[MAX_LOOP_COMMANDS];
@@ -387,7 +1459,7 @@ bool Rule::validateLoopCommands(const char* commands) {
     while (*cmd) {
         if (*cmd == ';') {
             *cmd = '\0';
-            if (!validateSingleLoopCommand(start)) return false;
+            if (!parseSingleLoopCommand(start, timed)) return false;
             start = cmd + 1;
         }
         cmd++;
@@ -395,21 +1467,26 @@ bool Rule::validateLoopCommands(const char* commands) {
     
     // Проверяем последнюю команду
     if (start < cmd && *start) {
-        if (!validateSingleLoopCommand(start)) return false;
+        if (!parseSingleLoopCommand(start, timed)) return false;
     }
     
     return true;
 }
 
 // БАГ-ФИХ: Валидация одной команды цикла
-bool Rule::validateSingleLoopCommand(const char* command) {
+bool RuleImage::parseSingleLoopCommand(const char* command, bool timed) {
     if (!command || !*command) return false;
     
-    char* comma = strchr((char*)command, ',');
+    const char* comma = strchr(command, ',');
     if (!comma || comma == command) return false;
     
+    // НОВОЕ: шаг последовательности "P,S@мс"; без '@' длится один цикл
+    const char* at = strchr(command, '@');
+    word duration = 0;
+    if (at && !parseDuration(at + 1, duration)) return false;
+    
     // Проверяем что после запятой только один символ
-    if (!*(comma + 1) || *(comma + 2) != '\0') return false;
+    if (!*(comma + 1) || *(comma + 2) != (at ? '@' : '\0')) return false;
     
     // Проверяем пин
     int pinLen = comma - command;
@@ -420,326 +1497,487 @@ bool Rule::validateSingleLoopCommand(const char* command) {
     pinStr[pinLen] = '\0';
     
     int pin = atoi(pinStr);
-    if (!isPinValid(pin) || !isOutputPin(pin)) return false;
+    if (!isPinValid(pin)) return false;
+    byte index = outputIndex(pin);
+    if (index == 0xFF) return false;
     
     // Проверяем состояние
     char stateChar = *(comma + 1);
     if (stateChar != '0' && stateChar != '1') return false;
     
-    return true;
+    if (!emit(OP_SET, index, (stateChar == '1') ? 1 : 0)) return false;
+    return !timed || (emitByte(duration & 0xFF) && emitByte(duration >> 8));
 }
 
-// БАГ-ФИХ: Парсинг AND условия
-bool Rule::parseAndCondition(const char* condition, char* ampersand) {
-    char* comma1 = strchr((char*)condition, ',');
-    char* comma2 = strchr(ampersand + 1, ',');
-    
-    if (!comma1 || !comma2 || comma1 >= ampersand) return false;
-    
-    // Первое условие
-    int pin1Len = comma1 - condition;
-    if (pin1Len <= 0 || pin1Len > 2) return false;
-    
-    char pin1Str[4];
-    strncpy(pin1Str, condition, pin1Len);
-    pin1Str[pin1Len] = '\0';
-    
-    int pin1 = atoi(pin1Str);
-    if (!isPinValid(pin1) || !isInputPin(pin1)) return false;
-    
-    // БАГ-ФИХ: Проверяем что состояние только один символ
-    if (comma1 + 2 != ampersand) return false; // Только один символ между , и &
-    char state1Char = *(comma1 + 1);
-    if (state1Char != '0' && state1Char != '1') return false;
-    
-    // Второе условие
-    int pin2Len = comma2 - (ampersand + 1);
-    if (pin2Len <= 0 || pin2Len > 2) return false;
-    
-    char pin2Str[4];
-    strncpy(pin2Str, ampersand + 1, pin2Len);
-    pin2Str[pin2Len] = '\0';
-    
-    int pin2 = atoi(pin2Str);
-    if (!isPinValid(pin2) || !isInputPin(pin2)) return false;
-    
-    // БАГ-ФИХ: Проверяем что после запятой только один символ
-    if (*(comma2 + 2) != '\0') return false;
-    char state2Char = *(comma2 + 1);
-    if (state2Char != '0' && state2Char != '1') return false;
-    
-    parsed.trigger1 = pin1;
-    parsed.tState1 = (state1Char == '1') ? 1 : 0;
-    parsed.trigger2 = pin2;
-    parsed.tState2 = (state2Char == '1') ? 1 : 0;
-    parsed.useAND = true;
-    
-    return true;
-}
+// Разбор выражения условия в таблицу истинности по переменным - входам
+// условия (та же грамматика и те же проверки, что egParseOr() в EgLangCompile.h)
+struct ConditionParser {
+    const char* s;
+    byte end;
+    byte pos;
+    InputMask used;
+    bool ok;
+    
+    uint64_t parseOr();
+    uint64_t parseAnd();
+    uint64_t parseUnary();
+    uint64_t parseAtom();
+    uint64_t fail() { ok = false; return 0; }
+};
 
-// БАГ-ФИХ: Парсинг простого условия
-bool Rule::parseSimpleCondition(const char* condition) {
-    char* comma = strchr((char*)condition, ',');
-    if (!comma || comma == condition) return false;
-    
-    // БАГ-ФИХ: Проверяем что после запятой только один символ
-    if (!*(comma + 1) || *(comma + 2) != '\0') return false;
-    
-    int pinLen = comma - condition;
-    if (pinLen <= 0 || pinLen > 2) return false;
-    
-    char pinStr[4];
-    strncpy(pinStr, condition, pinLen);
-    pinStr[pinLen] = '\0';
-    
-    int pin = atoi(pinStr);
-    if (!isPinValid(pin) || !isInputPin(pin)) return false;
-    
-    char stateChar = *(comma + 1);
-    if (stateChar != '0' && stateChar != '1') return false;
-    
-    parsed.trigger1 = pin;
-    parsed.tState1 = (stateChar == '1') ? 1 : 0;
-    
-    return true;
+uint64_t ConditionParser::parseOr() {
+    uint64_t table = parseAnd();
+    while (ok && pos < end && s[pos] == '|') {
+        pos++;
+        table |= parseAnd();
+    }
+    return table;
 }
 
-bool Rule::executeLoopCommand(const char* command) {
-    if (!command || !*command) return true;
-    
-    char* comma = strchr((char*)command, ',');
-    if (!comma || comma == command) return false;
-    
-    int pinLen = comma - command;
-    if (pinLen <= 0 || pinLen > 2) return false;
-    
-    char pinStr[4];
-    strncpy(pinStr, command, pinLen);
-    pinStr[pinLen] = '\0';
-    
-    int pin = atoi(pinStr);
-    if (!isPinValid(pin) || !isOutputPin(pin)) return false;
-    
-    char stateChar = *(comma + 1);
-    if (stateChar != '0' && stateChar != '1') return false;
-    
-    byte state = (stateChar == '1') ? 1 : 0;
-    
-    // УБРАНО: Проверка состояния пина
-    // Теперь команды выполняются каждый раз, как и должно быть в цикле
-    _eglang.setPinOutput(pin, state);
-    
-    return true;
+uint64_t ConditionParser::parseAnd() {
+    uint64_t table = parseUnary();
+    while (ok && pos < end && s[pos] == '&') {
+        pos++;
+        table &= parseUnary();
+    }
+    return table;
 }
 
-void Rule::executeLoopCommands() {
-    if (!parsed.loopCommands[0]) return;
-    
-    char temp[MAX_LOOP_COMMANDS];
-    strncpy(temp, parsed.loopCommands, MAX_LOOP_COMMANDS - 1);
-    temp[MAX_LOOP_COMMANDS - 1] = '\0';
-    
-    char* cmd = temp;
-    char* start = cmd;
+uint64_t ConditionParser::parseUnary() {
+    if (pos >= end) return fail();
     
-    while (*cmd) {
-        if (*cmd == ';') {
-            *cmd = '\0';
-            executeLoopCommand(start);
-            start = cmd + 1;
-        }
-        cmd++;
+    if (s[pos] == '~') {
+        pos++;
+        return ~parseUnary();
     }
-    
-    if (start < cmd && *start) {
-        executeLoopCommand(start);
+    if (s[pos] == '(') {
+        pos++;
+        uint64_t table = parseOr();
+        if (!ok || pos >= end || s[pos] != ')') return fail();
+        pos++;
+        return table;
     }
+    return parseAtom();
+}
+
+// "P,S": пин из 1-2 цифр (только INPUT), состояние 0 или 1
+uint64_t ConditionParser::parseAtom() {
+    byte p = pos;
+    while (p < end && egIsDigit(s[p])) p++;
+    
+    int pin = egNumber(s, pos, p);
+    if (pin < 0 || p + 1 >= end || s[p] != ',') return fail();
+    if (s[p + 1] != '0' && s[p + 1] != '1') return fail();
+    if (!RuleImage::isPinValid(pin)) return fail();
+    byte index = RuleImage::inputIndex(pin);
+    if (index == 0xFF) return fail();
+    
+    pos = p + 2;
+    byte var = egPopcount(used & (((InputMask)1 << index) - 1));
+    return (s[p + 1] == '1') ? egVarPattern(var) : ~egVarPattern(var);
 }
 
-// ИСПРАВЛЕННЫЙ МЕТОД: Полный анализ всех команд в цикле
-bool Rule::hasAlternatingCommands() {
-    if (!parsed.loopCommands[0]) return false;
+// Условие в термы (inputs & care) == value. Жадное покрытие, как в
+// egTermAt(): первая непокрытая строка таблицы расширяется, пока куб
+// не выходит за условие; затем лишние термы удаляются
+bool RuleImage::parseCondition(const char* condition, byte len) {
+    // Входы условия: пины перед ','
+    InputMask used = 0;
+    for (byte i = 0; i < len; ) {
+        if (!egIsDigit(condition[i])) {
+            i++;
+            continue;
+        }
+        byte p = i;
+        while (p < len && egIsDigit(condition[p])) p++;
+        
+        int pin = egNumber(condition, i, p);
+        if (p < len && condition[p] == ',' && pin >= 0 && isPinValid(pin) && inputIndex(pin) != 0xFF) {
+            used |= (InputMask)1 << inputIndex(pin);
+        }
+        i = p;
+    }
     
-    char temp[MAX_LOOP_COMMANDS];
-    strncpy(temp, parsed.loopCommands, MAX_LOOP_COMMANDS - 1);
-    temp[MAX_LOOP_COMMANDS - 1] = '\0';
+    byte vars = egPopcount(used);
+    if (vars > EGLANG_COND_VARS) return false;
     
-    // Собираем все команды в массив
-    char* commands[10]; // Максимум 10 команд
-    int commandCount = 0;
+    ConditionParser parser = { condition, len, 0, used, true };
+    uint64_t on = parser.parseOr() & egRowMask(vars);
+    if (!parser.ok || parser.pos != len) return false;
     
-    char* cmd = temp;
-    char* start = cmd;
+    // Жадное покрытие
+    byte cares[EGLANG_COND_CANDIDATES];
+    byte values[EGLANG_COND_CANDIDATES];
+    byte terms = 0;
+    uint64_t covered = 0;
+    for (byte m = 0; m < (1 << vars); m++) {
+        if (!((on >> m) & 1) || ((covered >> m) & 1)) continue;
+        
+        byte care = (1 << vars) - 1;
+        for (byte b = 0; b < vars; b++) {
+            byte wider = care & ~(1 << b);
+            if ((egCube(wider, m & wider, vars) & egRowMask(vars) & ~on) == 0) care = wider;
+        }
+        
+        if (terms == EGLANG_COND_CANDIDATES) return false;
+        cares[terms] = care;
+        values[terms] = m & care;
+        terms++;
+        covered |= egCube(care, m & care, vars);
+    }
     
-    // Разбиваем строку по ';'
-    while (*cmd && commandCount < 10) {
-        if (*cmd == ';') {
-            *cmd = '\0';
-            // Удаляем пробелы в начале команды
-            while (*start == ' ') start++;
-            if (*start) {
-                commands[commandCount++] = start;
-            }
-            start = cmd + 1;
+    // Удаление лишних термов с конца, как egPrune()
+    word kept = (1 << terms) - 1;
+    for (int8_t k = terms - 1; k >= 0; k--) {
+        uint64_t others = 0;
+        for (byte j = 0; j < terms; j++) {
+            if (j != k && ((kept >> j) & 1)) others |= egCube(cares[j], values[j], vars);
         }
-        cmd++;
+        if ((egCube(cares[k], values[k], vars) & egRowMask(vars) & ~others) == 0) kept &= ~(1 << k);
     }
+    if (egPopcount(kept) > EGLANG_MAX_TERMS) return false;
     
-    // Добавляем последнюю команду
-    if (start < cmd && *start && commandCount < 10) {
-        while (*start == ' ') start++;
-        commands[commandCount++] = start;
+    for (byte k = 0; k < terms; k++) {
+        if (!((kept >> k) & 1)) continue;
+        emitMask(egSpread(cares[k], used));
+        emitMask(egSpread(values[k], used));
+    }
+    return true;
+}
+
+// Аналоговое условие "An>порог" или "An<порог": канал профиля (одна цифра)
+// и порог 0-65535, как egAnalogValid() в EgLangCompile.h
+bool RuleImage::parseAnalog(const char* condition, byte len) {
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+    if (len < 4 || len > 8 || !egIsDigit(condition[1])) return false;
+    byte channel = condition[1] - '0';
+    char compare = condition[2];
+    if (channel >= ANALOG_COUNT || (compare != '>' && compare != '<')) return false;
+    
+    char digits[6];
+    strncpy(digits, condition + 3, len - 3);
+    digits[len - 3] = '\0';
+    word threshold;
+    if (!parseDuration(digits, threshold)) return false;
+    
+    return emitByte(channel | (compare == '<' ? ANALOG_BELOW : 0)) &&
+           emitByte(threshold & 0xFF) && emitByte(threshold >> 8);
+#else
+    (void)condition;
+    (void)len;
+    return false;
+#endif
+}
+
+// Структура записи: коды операций, индексы пинов и термы в допустимых
+// пределах (для записей, прочитанных не через parse())
+bool RuleImage::wellFormed() const {
+    if (!header.valid || header.length == 0 || header.length > MAX_RULE_CODE) return false;
+    
+    Instr first = egDecode(loadInstr(code));
+    if (header.kind == RULE_LOOP || header.kind == RULE_SEQUENCE) {
+        if (header.length < 2 * INSTR_SIZE || first.op != OP_LOOP || first.index >= INPUT_COUNT) return false;
+    } else if (header.kind == RULE_CONDITIONAL) {
+        if (first.op == OP_LOOP || first.index >= OUTPUT_COUNT) return false;
+    } else {
+        if ((first.op != OP_SET && first.op != OP_PWM) || first.index >= OUTPUT_COUNT) return false;
     }
     
-    // Если только одна команда - не чередующаяся
-    if (commandCount <= 1) {
-        Serial.println("Single command - NOT alternating");
-        return false;
+    // ШИМ: выход с ШИМ, состояние - скважность не 0
+    if (first.op == OP_PWM) {
+        if (!EGLANG_ANALOG || !egPwmOutput(first.index) || header.length <= INSTR_SIZE) return false;
+        if ((code[INSTR_SIZE] != 0) != first.state) return false;
     }
     
-    // Анализируем все команды
-    Serial.print("Found commands: ");
-    for (int i = 0; i < commandCount; i++) {
-        Serial.print("'"); Serial.print(commands[i]); Serial.print("' ");
+    if (header.kind == RULE_SIMPLE) return header.length == egActionSize(first.op);
+    
+    if (header.kind == RULE_CONDITIONAL) {
+        byte start = egActionSize(first.op);
+        if (header.length < start || header.length > MAX_COND_CODE) return false;
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+        // Аналоговое условие - нечетной длины, термы - всегда четной
+        if (header.length - start == ANALOG_COND_SIZE) return (code[start] & ~ANALOG_BELOW) < ANALOG_COUNT;
+#endif
+        if ((header.length - start) % TERM_SIZE || (header.length - start) / TERM_SIZE > EGLANG_MAX_TERMS) return false;
+        for (byte k = start; k < header.length; k += TERM_SIZE) {
+            InputMask care = loadMask(&code[k]);
+            if ((care >> (INPUT_COUNT - 1)) >> 1) return false;
+            if (loadMask(&code[k + MASK_SIZE]) & ~care) return false;
+        }
+        return true;
     }
-    Serial.println();
     
-    // Проверяем есть ли хотя бы две разные команды
-    bool hasAlternation = false;
-    for (int i = 0; i < commandCount - 1; i++) {
-        for (int j = i + 1; j < commandCount; j++) {
-            if (strcmp(commands[i], commands[j]) != 0) {
-                Serial.print("Different commands found: '");
-                Serial.print(commands[i]); Serial.print("' != '");
-                Serial.print(commands[j]); Serial.println("'");
-                hasAlternation = true;
-                break;
+    // Шаг последовательности - команда и 2 байта длительности
+    byte stride = INSTR_SIZE;
+    if (header.kind == RULE_SEQUENCE) stride = STEP_SIZE;
+    if ((header.length - INSTR_SIZE) % stride) return false;
+    if (header.kind == RULE_SEQUENCE && header.length > MAX_SEQUENCE_CODE) return false;
+    for (byte i = INSTR_SIZE; i < header.length; i += stride) {
+        Instr in = egDecode(loadInstr(&code[i]));
+        if (in.op != OP_SET || in.index >= OUTPUT_COUNT) return false;
+    }
+    return true;
+}
+
+// Есть ли в цикле хотя бы две разные команды (вычисляется один раз при разборе)
+bool RuleImage::detectAlternating() {
+    for (byte i = INSTR_SIZE; i < header.length; i += INSTR_SIZE) {
+        for (byte j = i + INSTR_SIZE; j < header.length; j += INSTR_SIZE) {
+            if (memcmp(&code[i], &code[j], INSTR_SIZE) != 0) {
+                return true;
             }
         }
-        if (hasAlternation) break;
     }
-    
-    if (!hasAlternation) {
-        Serial.println("All commands are SAME - NOT alternating");
+    return false;
+}
+
+// Пока вход нажат, цикл пишет все свои команды, а последовательность -
+// команду текущего шага, в кадр каждого цикла: выход держится, как у
+// условного правила, и сводится с другими записями по номерам правил.
+// Команды одного цикла попадают в один кадр, поэтому на пин приходит
+// итог по политике, а не чередование
+void Rule::hold(EgLangController& ctl) {
+    if (header.kind == RULE_SEQUENCE) {
+        Instr in = stepAction(step);
+        ctl.request(in.index, in.state);
+        return;
+    }
+    for (byte i = INSTR_SIZE; i < header.length; i += INSTR_SIZE) {
+        Instr in = instr(i);
+        ctl.request(in.index, in.state);
     }
-    
-    return hasAlternation;
 }
 
 // НОВЫЙ МЕТОД: Выключение всех пинов цикла при выходе
-void Rule::executeLoopCommandsOff() {
-    if (!parsed.loopCommands[0]) return;
-    
-    Serial.println("Exiting loop - turning OFF pins");
-    
-    char temp[MAX_LOOP_COMMANDS];
-    strncpy(temp, parsed.loopCommands, MAX_LOOP_COMMANDS - 1);
-    temp[MAX_LOOP_COMMANDS - 1] = '\0';
-    
-    char* cmd = temp;
-    char* start = cmd;
-    
-    while (*cmd) {
-        if (*cmd == ';') {
-            *cmd = '\0';
-            executeLoopCommandOff(start);
-            start = cmd + 1;
-        }
-        cmd++;
+void Rule::executeLoopCommandsOff(EgLangController& ctl) {
+    byte stride = (header.kind == RULE_SEQUENCE) ? STEP_SIZE : INSTR_SIZE;
+    for (byte i = INSTR_SIZE; i < header.length; i += stride) {
+        ctl.request(instr(i).index, 0);
     }
-    
-    if (start < cmd && *start) {
-        executeLoopCommandOff(start);
+}
+
+// Вход в последовательность: первый шаг отсчитывается от начала цикла
+void Rule::startSequence(EgLangController& ctl) {
+    step = 0;
+    stepStart = ctl.lastSampleMs;
+    EGLANG_STATS_FIRE(ctl, this - ctl.rules);
+    hold(ctl);
+}
+
+// Один шаг за цикл и только по истечении длительности текущего - без
+// ожидания и без прохода по всем командам
+void Rule::advanceSequence(EgLangController& ctl) {
+    unsigned long now = ctl.lastSampleMs;
+    word duration = stepDuration(step);
+    if (now - stepStart >= duration) {
+        // Следующий шаг отсчитывается от конца текущего, поэтому период не
+        // уплывает на дрожание цикла; при отставании больше чем на шаг - от now
+        stepStart += duration;
+        step = (step + 1 < steps()) ? step + 1 : 0;
+        if (now - stepStart >= stepDuration(step)) stepStart = now;
+        EGLANG_STATS_FIRE(ctl, this - ctl.rules);
     }
+    hold(ctl);
 }
 
-// НОВЫЙ МЕТОД: Выключение одной команды цикла
-void Rule::executeLoopCommandOff(const char* command) {
-    if (!command || !*command) return;
-    
-    char* comma = strchr((char*)command, ',');
-    if (!comma || comma == command) return;
-    
-    int pinLen = comma - command;
-    if (pinLen <= 0 || pinLen > 2) return;
-    
-    char pinStr[4];
-    strncpy(pinStr, command, pinLen);
-    pinStr[pinLen] = '\0';
-    
-    int pin = atoi(pinStr);
-    if (!isPinValid(pin) || !isOutputPin(pin)) return;
-    
-    // Устанавливаем пин в LOW при выходе из цикла
-    _eglang.setPinOutput(pin, 0);
+bool Rule::conditionMet(EgLangController& ctl, InputMask snapshot) const {
+#if EGLANG_ANALOG
+    // Порог с гистерезисом: состояние - выполнено ли условие в прошлый раз
+    if (analogCondition()) {
+        byte channel = raw(termStart());
+        return egAnalogCompare(ctl.analogValue(channel & 0x0F), rawWord(termStart() + 1),
+                               channel & ANALOG_BELOW, active);
+    }
+#else
+    (void)ctl;
+#endif
+#if EGLANG_OPTIMIZE
+    // Общие термы - из кеша контроллера, в образе они пропускаются
+    if (sharedTerms && ctl.sharedTermMet(sharedTerms, snapshot)) return true;
+    byte term = 0;
+    for (byte k = termStart(); k + TERM_SIZE <= header.length; k += TERM_SIZE, term++) {
+        if ((sharedAt >> term) & 1) continue;
+        if ((snapshot & mask(k)) == mask(k + MASK_SIZE)) return true;
+    }
+#else
+    for (byte k = termStart(); k + TERM_SIZE <= header.length; k += TERM_SIZE) {
+        if ((snapshot & mask(k)) == mask(k + MASK_SIZE)) return true;
+    }
+#endif
+    return false;
 }
 
-// БАГ-ФИХ: Улучшенное чтение пинов с защитой от наводок (перенесено в Controller)
-bool Rule::readPinStable(byte pin) {
-    return _eglang.readPinStable(pin);
+InputMask Rule::inputMask() const {
+    if (header.kind == RULE_LOOP || header.kind == RULE_SEQUENCE) return (InputMask)1 << instr(0).index;
+    
+    InputMask reads = 0;
+#if EGLANG_ANALOG
+    if (analogCondition()) return 0;
+#endif
+    if (header.kind == RULE_CONDITIONAL) {
+        for (byte k = termStart(); k + TERM_SIZE <= header.length; k += TERM_SIZE) reads |= mask(k);
+    }
+    return reads;
 }
 
-bool Rule::check() {
-    if (!parsed.valid) return false;
+bool Rule::check(EgLangController& ctl) {
+    if (!image) return false;
     
     // Обработка циклов - ИСПРАВЛЕННАЯ ЛОГИКА
-    if (parsed.isLoop) {
-        if (!parsed.inLoop) {
-            if (_eglang.readPinStable(parsed.loopPin)) {
-                parsed.inLoop = true;
-                executeLoopCommands(); // Выполняем команды при входе в цикл
+    if (header.kind == RULE_LOOP || header.kind == RULE_SEQUENCE) {
+        byte input = instr(0).index;
+        bool pressed = ctl.readInput(input);
+        if (!inLoop) {
+            if (pressed) {
+                inLoop = true;
+                EGLANG_TRACE(ctl, 1, TRACE_LOOP_ENTER, this - ctl.rules, pgm_read_byte(&inputs[input]));
+                if (header.kind == RULE_SEQUENCE) {
+                    startSequence(ctl);
+                } else {
+                    EGLANG_STATS_FIRE(ctl, this - ctl.rules);
+                    hold(ctl);   // Выполняем команды при входе в цикл
+                }
             }
             return false;
         } else {
-            if (_eglang.readPinStable(parsed.loopPin)) {
-                // ИСПРАВЛЕНИЕ: Проверяем есть ли разные команды в цикле
-                if (hasAlternatingCommands()) {
-                    // Для команд типа [3:8,1;8,0] - выполняем постоянно
-                    executeLoopCommands();
+            if (pressed) {
+                // [5:10,1@200;10,0@300] - следующий шаг, когда истек текущий;
+                // [3:8,1] и [3:8,1;8,0] держат свои выходы
+                if (header.kind == RULE_SEQUENCE) {
+                    advanceSequence(ctl);
+                } else {
+                    hold(ctl);
                 }
-                // Для команд типа [3:8,1] - НЕ выполняем повторно
                 return false;
             } else {
-                parsed.inLoop = false;
-                executeLoopCommandsOff(); // Выключаем при выходе
+                inLoop = false;
+                EGLANG_TRACE(ctl, 1, TRACE_LOOP_EXIT, this - ctl.rules, pgm_read_byte(&inputs[input]));
+                executeLoopCommandsOff(ctl); // Выключаем при выходе
                 done = true;
                 return true;
             }
         }
     }
     
+    Instr act = action();
+    
     // Простые команды (выполняются один раз)
-    if (parsed.isSimpleCommand) {
+    if (header.kind == RULE_SIMPLE) {
         if (done) return false;
         done = true;
-        _eglang.setPinOutput(parsed.action, parsed.aState);
+        fire(ctl, act);
         return true;
     }
     
-    // Условные правила
-    if (parsed.isContinuous) {
-        bool condition1 = (_eglang.readPinStable(parsed.trigger1) == (parsed.tState1 == 1));
-        bool condition2 = true;
-        
-        if (parsed.useAND) {
-            condition2 = (_eglang.readPinStable(parsed.trigger2) == (parsed.tState2 == 1));
-        }
-        
-        if (condition1 && condition2) {
-            _eglang.setPinOutput(parsed.action, parsed.aState);
-            return true;
-        } else {
-            if (parsed.aState == 1) {
-                _eglang.setPinOutput(parsed.action, 0);
+    // Фронты и таймеры
+    if (header.kind == RULE_CONDITIONAL && !egLevelOp(act.op)) return checkEvent(ctl, act);
+    
+    // Условные правила: владение выходом меняется только при смене условия
+    if (header.kind == RULE_CONDITIONAL) {
+        bool met = conditionMet(ctl, ctl.inputSnapshot);
+        if (met != active) {
+            active = met;
+            ctl.updateOwner(this - ctl.rules, act.index, met);
+            if (met) {
+                EGLANG_TRACE(ctl, 2, TRACE_RULE_FIRE, this - ctl.rules, pgm_read_byte(&outputs[act.index]));
+                EGLANG_STATS_FIRE(ctl, this - ctl.rules);
             }
-            return false;
         }
+        return met;
     }
     
     return false;
 }
 
+// Фронт или таймер: выход пишется только при смене выхода Q правила
+// (done), поэтому правило проверяется лишь при изменении его входов
+// или по колесу таймеров
+bool Rule::checkEvent(EgLangController& ctl, Instr act) {
+    bool met = conditionMet(ctl, ctl.inputSnapshot);
+    bool rising = met && !active;
+    bool falling = !met && active;
+    active = met;
+    
+    switch (act.op) {
+        case OP_EDGE:
+            if (rising) fire(ctl, act);
+            return rising;
+        case OP_TOGGLE:
+            if (rising) {
+                act.state = !((ctl.outputState >> act.index) & 1);
+                fire(ctl, act);
+            }
+            return rising;
+        case OP_TON:
+            if (rising) startTimer(ctl);
+            if (falling) {
+                stopTimer(ctl);
+                setTimerOutput(ctl, act, false);
+            }
+            break;
+        case OP_TOF:
+            if (rising) {
+                stopTimer(ctl);
+                setTimerOutput(ctl, act, true);
+            }
+            if (falling) startTimer(ctl);
+            break;
+        case OP_PULSE:
+            // Повторный фронт во время импульса не продлевает его
+            if (rising && !done) {
+                setTimerOutput(ctl, act, true);
+                startTimer(ctl);
+            }
+            break;
+    }
+    
+    // Срок истек: TON включает выход, TOF и импульс выключают
+    if (inLoop && ctl.lastSampleMs - stepStart >= timerDuration()) {
+        stopTimer(ctl);
+        setTimerOutput(ctl, act, act.op == OP_TON);
+    }
+    return done;
+}
+
+// Выход Q таймера: при включении - действие, при выключении - обратное состояние
+void Rule::setTimerOutput(EgLangController& ctl, Instr act, bool q) {
+    if (done == q) return;
+    done = q;
+    if (!q) act.state = !act.state;
+    fire(ctl, act);
+}
+
+void Rule::startTimer(EgLangController& ctl) {
+    inLoop = true;
+    stepStart = ctl.lastSampleMs;
+    ctl.armTimer(this - ctl.rules, timerDuration());
+}
+
+void Rule::stopTimer(EgLangController& ctl) {
+    if (!inLoop) return;
+    inLoop = false;
+    ctl.cancelTimer(this - ctl.rules);
+}
+
+// Запрос действия в кадр; срабатывание трассируется, если пин должен измениться
+void Rule::fire(EgLangController& ctl, Instr action) {
+#if EGLANG_TRACE_LEVEL >= 2
+    if (((ctl.outputState >> action.index) & 1) != action.state) {
+        EGLANG_TRACE(ctl, 2, TRACE_RULE_FIRE, this - ctl.rules, pgm_read_byte(&outputs[action.index]));
+    }
+#endif
+    EGLANG_STATS_FIRE(ctl, this - ctl.rules);
+#if EGLANG_ANALOG
+    if (action.op == OP_PWM) {
+        ctl.requestDuty(action.index, duty());
+        return;
+    }
+#endif
+    ctl.request(action.index, action.state);
+}
+
 void Rule::reset() {
     done = false;
-    parsed.inLoop = false;
+    inLoop = false;
+    step = 0;
 }
@@ -2,116 +2,584 @@
 #define EGLANG_H
 
 #include <Arduino.h>
+#include "EgLangPins.h"
+#include "EgLangTrace.h"
+#include "EgLangAnalog.h"
+#include "EgLangOptimize.h"
 
-// Максимальное количество правил (уменьшено для экономии памяти)
-#define MAX_RULES 20
-#define MAX_RULE_LENGTH 32
-#define MAX_LOOP_COMMANDS 24
+// Максимальное количество правил. Текст разобранных правил хранится в арене
+// EGLANG_ARENA_SIZE, здесь ограничено только число дескрипторов (8 байт)
+#ifndef MAX_RULES
+#define MAX_RULES 32
+#endif
+#define MAX_RULE_LENGTH 48                // Только для разбора, в SRAM не хранится
+#define MAX_LOOP_COMMANDS 40
+#define MAX_SEQUENCE_STEPS 4              // Шагов с длительностью "[5:10,1@200;10,0@300]"
+
+// Окно антидребезга в миллисекундах (0 - без фильтра)
+#ifndef EGLANG_DEBOUNCE_MS
+#define EGLANG_DEBOUNCE_MS 4
+#endif
+static_assert(EGLANG_DEBOUNCE_MS <= 255, "EGLANG_DEBOUNCE_MS must fit the byte debounce integrator");
+
+// Период цикла планировщика poll() по умолчанию
+#ifndef EGLANG_SCAN_PERIOD_MS
+#define EGLANG_SCAN_PERIOD_MS 50
+#endif
+
+// Таблица LUT в SRAM для compileLut() (1 - включена, занимает 2 * 64 байт)
+#ifndef EGLANG_LUT
+#define EGLANG_LUT 0
+#endif
+// Таблица на все снимки входов - только для профилей до 8 входов
+#if INPUT_COUNT <= 8
+#define LUT_SIZE (1 << INPUT_COUNT)
+#else
+#define LUT_SIZE 0
+#endif
+static_assert(!EGLANG_LUT || LUT_SIZE > 0, "EGLANG_LUT needs at most 8 inputs");
+
+// Образ правил в EEPROM через avr/eeprom.h (на AVR включен по умолчанию)
+#ifndef EGLANG_EEPROM
+#if defined(__AVR__)
+#define EGLANG_EEPROM 1
+#else
+#define EGLANG_EEPROM 0
+#endif
+#endif
+#ifndef EGLANG_EEPROM_ADDR
+#define EGLANG_EEPROM_ADDR 0
+#endif
+#define EGLANG_IMAGE_VERSION 2            // Меняется вместе с форматом RuleImage
+
+// AUTO_START сначала загружает образ из EEPROM и только при ошибке берет
+// правила скетча. Макрос раскрывается в скетче, поэтому достаточно
+// #define EGLANG_EEPROM_BOOT 1 перед #include <EgLang.h>
+#ifndef EGLANG_EEPROM_BOOT
+#define EGLANG_EEPROM_BOOT 0
+#endif
+
+// Маска правил: бит i - rules[i]
+#if MAX_RULES > 32
+typedef uint64_t RuleMask;
+#else
+typedef uint32_t RuleMask;
+#endif
+static_assert(MAX_RULES <= 63, "rule count is a 6-bit field");
+
+#include "EgLangStats.h"              // Счетчикам нужен MAX_RULES
+
+// Коды операций предекодированного правила
+enum : byte {
+    OP_PWM    = 0,                   // Действие: выход <- скважность (байт за инструкцией), "P,=D"
+    OP_SET    = 1,                   // Действие: выход <- state
+    OP_LOOP   = 2,                   // Заголовок цикла: пока вход активен
+    OP_EDGE   = 3,                   // "^усл!P,S": выход <- state по фронту условия
+    OP_TOGGLE = 4,                   // "^усл!P,~": переключить выход по фронту
+    OP_TON    = 5,                   // "?усл+мс!P,S": задержка включения
+    OP_TOF    = 6,                   // "?усл-мс!P,S": задержка выключения
+    OP_PULSE  = 7                    // "?усл*мс!P,S": импульс по фронту
+};
+
+// За действием таймера - длительность (2 байта, мс)
+constexpr bool egTimerOp(byte op) {
+    return op >= OP_TON;
+}
+
+// Действие держит выход, пока выполнено условие (владение выходом)
+constexpr bool egLevelOp(byte op) {
+    return op == OP_SET || op == OP_PWM;
+}
+
+// Инструкция в записи - байт, а при списках пинов длиннее 16 - два байта
+#if INPUT_COUNT > 16 || OUTPUT_COUNT > 16
+typedef uint16_t InstrCode;
+#define INSTR_SIZE 2
+#define INSTR_INDEX_BITS 8
+#else
+typedef byte InstrCode;
+#define INSTR_SIZE 1
+#define INSTR_INDEX_BITS 4
+#endif
+
+// Одна инструкция правила. index - позиция пина
+// в inputs[] (OP_LOOP) или в outputs[] (остальные)
+struct Instr {
+    byte op : 3;
+    byte state : 1;
+    byte index : INSTR_INDEX_BITS;
+};
+
+// Инструкция: op (биты 0-2), state (бит 3), index (с бита 4), младшим байтом
+// вперед. Кодирование явное, чтобы RF() и parse() давали одинаковые байты
+constexpr InstrCode egEncode(byte op, byte state, byte index) {
+    return (InstrCode)(op | (state << 3) | (index << 4));
+}
+
+inline Instr egDecode(InstrCode raw) {
+    Instr in;
+    in.op = raw & 7;
+    in.state = (raw >> 3) & 1;
+    in.index = raw >> 4;
+    return in;
+}
+
+// Байт действия в записи: инструкция, у таймера длительность (2 байта),
+// у ШИМ скважность (1 байт)
+constexpr byte egActionSize(byte op) {
+    return INSTR_SIZE + (egTimerOp(op) ? 2 : (op == OP_PWM ? 1 : 0));
+}
+
+// Выход outputs[index] умеет ШИМ
+constexpr bool egPwmOutput(int index) {
+    return index >= 0 && (((uint64_t)(EGLANG_PWM_OUTPUTS) >> index) & 1);
+}
+
+// Условие - сумма произведений: выполнено, если для какого-нибудь терма
+// (inputs & care) == value. Не больше EGLANG_COND_VARS разных входов в условии
+#ifndef EGLANG_MAX_TERMS
+#define EGLANG_MAX_TERMS 4
+#endif
+#define EGLANG_COND_VARS 6
+#define EGLANG_COND_CANDIDATES (2 * EGLANG_MAX_TERMS)   // Термов до удаления лишних
+static_assert(!EGLANG_OPTIMIZE || (EGLANG_MAX_TERMS <= 8 && EGLANG_SHARED_TERMS <= 8), "shared terms are byte masks");
+
+// Терм - маски care и value по MASK_SIZE байт, шаг последовательности -
+// команда и длительность (2 байта, мс)
+#define TERM_SIZE (2 * MASK_SIZE)
+#define STEP_SIZE (INSTR_SIZE + 2)
+
+// Максимум байт кода: цикл (заголовок + команды из MAX_LOOP_COMMANDS символов),
+// условие (действие, длительность таймера, термы) или последовательность
+// (заголовок + шаги)
+#define MAX_LOOP_CODE (INSTR_SIZE * ((MAX_LOOP_COMMANDS + 1) / 4 + 1))
+#define MAX_COND_CODE (INSTR_SIZE + 2 + TERM_SIZE * EGLANG_MAX_TERMS)
+#define MAX_SEQUENCE_CODE (INSTR_SIZE + STEP_SIZE * MAX_SEQUENCE_STEPS)
+#define EGLANG_MAX2(a, b) ((a) > (b) ? (a) : (b))
+#define MAX_RULE_CODE EGLANG_MAX2(EGLANG_MAX2(MAX_LOOP_CODE, MAX_COND_CODE), MAX_SEQUENCE_CODE)
+
+// Длина кода в заголовке: 4 бита (заголовок - один байт), если код
+// помещается, иначе отдельный байт
+#if MAX_RULE_CODE <= 15
+#define HEADER_LENGTH_BITS 4
+#else
+#define HEADER_LENGTH_BITS 8
+#endif
+static_assert(MAX_RULE_CODE < (1 << HEADER_LENGTH_BITS), "rule code too large for RuleImage::Header::length");
+
+// Арена в SRAM для правил из add(): записи подряд, каждая - заголовок и только
+// занятые байты кода (на Uno простая команда - 2 байта, условие - 2 + 2 на терм,
+// цикл - 2 + команды, последовательность - 2 + 3 на шаг).
+// 0 - только правила из PROGMEM (RF())
+#ifndef EGLANG_ARENA_SIZE
+#define EGLANG_ARENA_SIZE 128
+#endif
+
+// Колесо таймеров правил: EGLANG_TIMER_SLOTS слотов по EGLANG_TIMER_TICK_MS.
+// Таймер попадает в слот тика, в котором истекает; за цикл просматриваются
+// только слоты прошедших тиков, длинный таймер - раз за оборот колеса
+#ifndef EGLANG_TIMER_SLOTS
+#define EGLANG_TIMER_SLOTS 8
+#endif
+#ifndef EGLANG_TIMER_TICK_MS
+#define EGLANG_TIMER_TICK_MS 16
+#endif
+static_assert((EGLANG_TIMER_SLOTS & (EGLANG_TIMER_SLOTS - 1)) == 0, "EGLANG_TIMER_SLOTS must be a power of two");
+static_assert((EGLANG_TIMER_TICK_MS & (EGLANG_TIMER_TICK_MS - 1)) == 0, "EGLANG_TIMER_TICK_MS must be a power of two");
+
+// Вид правила
+enum : byte {
+    RULE_SIMPLE = 0,                 // "2,1" - выполняется один раз
+    RULE_CONDITIONAL,                // "?3,0!4,1" - непрерывное условие, фронт или таймер
+    RULE_LOOP,                       // "[3:8,1;8,0]"
+    RULE_SEQUENCE                    // "[5:10,1@200;10,0@300]" - цикл с длительностями шагов
+};
+
+// Скомпилированное правило: заголовок и инструкции. Строится из текста
+// в parse() при add() или при компиляции скетча через RF() (EgLangCompile.h).
+// В арене хранится усеченным до size() байт
+struct RuleImage {
+    struct Header {
+        byte kind : 2;               // RULE_*
+        byte isAlternating : 1;      // В цикле есть разные команды
+        byte valid : 1;
+        byte length : HEADER_LENGTH_BITS; // Занято байт в code[]
+    } header;
+    
+    // Простая команда: OP_SET или OP_PWM и скважность. Условие: действие
+    // (OP_SET, OP_PWM, фронт или таймер), у таймера длительность (2 байта, мс),
+    // у ШИМ скважность, затем термы (care, value) или аналоговое условие
+    // (ANALOG_COND_SIZE байт - нечетная длина, термы всегда четные).
+    // Цикл: OP_LOOP, затем OP_SET на каждую команду.
+    // Последовательность: OP_LOOP, затем на шаг OP_SET и длительность (2 байта, мс).
+    // Инструкции - INSTR_SIZE байт, маски термов - MASK_SIZE байт, младшим вперед
+    byte code[MAX_RULE_CODE];
+    
+    bool parse(const char* text);
+    bool wellFormed() const;         // Структура записи (проверка образа из EEPROM)
+    byte size() const { return sizeof(Header) + header.length; } // Байт в арене
+    
+private:
+    friend struct ConditionParser;
+    
+    void parseLoop(const char* text, byte len);
+    void parseSimpleCommand(const char* text);
+    void parseConditionalRule(const char* text);
+    static bool isPinValid(byte pin);
+    static byte inputIndex(byte pin);
+    static byte outputIndex(byte pin);
+    bool emit(byte op, byte index, byte state);
+    bool emitByte(byte value);
+    bool emitMask(InputMask mask);
+    bool parseLoopCommands(const char* commands, bool timed);
+    bool parseSingleLoopCommand(const char* command, bool timed);
+    bool parseCondition(const char* condition, byte len);
+    bool parseAnalog(const char* condition, byte len);
+    bool detectAlternating();
+};
+static_assert(sizeof(RuleImage) == sizeof(RuleImage::Header) + MAX_RULE_CODE, "RuleImage must be byte-packed for the arena");
 
-// Конфигурация пинов (в PROGMEM для экономии SRAM)
-extern const byte inputs[] PROGMEM;
-extern const byte outputs[] PROGMEM;
+class EgLangController;
 
-// Компактная структура правила
+// Правило во время выполнения: ссылка на образ и состояние.
+// Образ лежит в арене SRAM (разобран из текста) или в PROGMEM (RF()).
+// Контроллер-владелец передается в check(): правило не ссылается на
+// глобальный _eglang, и контроллеров может быть несколько (хост-симулятор)
 struct Rule {
-    char ruleText[MAX_RULE_LENGTH];  // Фиксированный размер вместо String
-    bool done : 1;                   // Битовое поле
-    
-    struct ParsedRule {
-        byte trigger1 : 4;           // 4 бита для пина (0-15)
-        byte tState1 : 1;            // 1 бит для состояния
-        byte trigger2 : 4;           // 4 бита для пина
-        byte tState2 : 1;            // 1 бит для состояния
-        byte action : 4;             // 4 бита для пина
-        byte aState : 1;             // 1 бит для состояния
-        byte useAND : 1;             // 1 бит
-        byte isSimpleCommand : 1;    // 1 бит
-        byte isLoop : 1;             // 1 бит
-        byte isContinuous : 1;       // 1 бит - для непрерывных условий
-        byte loopPin : 4;            // 4 бита для пина
-        byte inLoop : 1;             // 1 бит
-        byte valid : 1;              // 1 бит
-        char loopCommands[MAX_LOOP_COMMANDS]; // Фиксированный размер
-    } parsed;
+    const RuleImage* image;
+    RuleImage::Header header;        // Копия заголовка - без чтения flash в цикле
+    bool inFlash : 1;                // Образ в PROGMEM
+    bool done : 1;                   // Битовое поле; у таймера - выход Q
+    bool inLoop : 1;                 // У таймера - отсчет идет
+    bool active : 1;                 // Условие выполнено, правило владеет выходом
+    byte step : 4;                   // Текущий шаг последовательности
+    unsigned long stepStart;         // millis() начала шага или таймера; 32 бита - сроки до 65535 мс без переполнения
+#if EGLANG_OPTIMIZE
+    byte sharedTerms;                // Общие термы условия (optimize()): бит t - sharedCare[t]
+    byte sharedAt;                   // Их места в образе: бит k - k-й терм, при проверке пропускается
+#endif
     
     Rule();
-    void setRule(const char* text);
-    void parseRule();
-    bool check();
+    byte raw(byte i) const;          // Байт кода образа из SRAM или PROGMEM
+    Instr instr(byte i) const;       // Инструкция с байта i
+    InputMask mask(byte i) const;    // Маска терма с байта i
+    Instr action() const { return instr(0); } // Простая команда и условие
+    byte termStart() const { return egActionSize(action().op); } // Первый терм условия
+    byte duty() const { return raw(INSTR_SIZE); }                // Скважность OP_PWM
+#if EGLANG_ANALOG
+    bool analogCondition() const {   // Условие по аналоговому каналу вместо термов
+        return header.kind == RULE_CONDITIONAL && header.length - termStart() == ANALOG_COND_SIZE;
+    }
+#endif
+    InputMask inputMask() const;     // Входы, которые читает правило
+    bool check(EgLangController& ctl);
+    void hold(EgLangController& ctl); // Цикл держит свои выходы: команды или текущий шаг - в кадр
     void reset();
+    bool conditionMet(EgLangController& ctl, InputMask snapshot) const; // Выполнен хотя бы один терм
     
 private:
-    void parseLoop();
-    void parseSimpleCommand();
-    void parseConditionalRule();
-    bool isPinValid(byte pin);
-    bool isInputPin(byte pin);
-    bool isOutputPin(byte pin);
-    bool validateLoopCommands(const char* commands);
-    bool validateSingleLoopCommand(const char* command);
-    bool parseAndCondition(const char* condition, char* ampersand);
-    bool parseSimpleCondition(const char* condition);
-    bool executeLoopCommand(const char* command);
-    void executeLoopCommands();
-    void executeLoopCommandsOff();       // Новый метод для выключения пинов цикла
-    void executeLoopCommandOff(const char* command); // Выключение одной команды
-    bool hasAlternatingCommands();       // Проверка наличия чередующихся команд
-    bool readPinStable(byte pin);
+    void executeLoopCommandsOff(EgLangController& ctl); // Новый метод для выключения пинов цикла
+    void fire(EgLangController& ctl, Instr action);
+    
+    // Последовательность: шаг k - команда и длительность
+    byte steps() const { return (header.length - INSTR_SIZE) / STEP_SIZE; }
+    Instr stepAction(byte k) const { return instr(INSTR_SIZE + STEP_SIZE * k); }
+    word stepDuration(byte k) const { return rawWord(2 * INSTR_SIZE + STEP_SIZE * k); }
+    void startSequence(EgLangController& ctl);
+    void advanceSequence(EgLangController& ctl);
+    
+    // Фронты и таймеры
+    word timerDuration() const { return rawWord(INSTR_SIZE); }
+    word rawWord(byte i) const { return raw(i) | (raw(i + 1) << 8); }
+    bool checkEvent(EgLangController& ctl, Instr act);
+    void setTimerOutput(EgLangController& ctl, Instr act, bool q);
+    void startTimer(EgLangController& ctl);
+    void stopTimer(EgLangController& ctl);
+};
+static_assert(MAX_SEQUENCE_STEPS <= 15, "sequence step is a 4-bit field");
+
+inline byte Rule::raw(byte i) const {
+    return inFlash ? pgm_read_byte(&image->code[i]) : image->code[i];
+}
+
+inline Instr Rule::instr(byte i) const {
+#if INSTR_SIZE == 1
+    return egDecode(raw(i));
+#else
+    return egDecode(rawWord(i));
+#endif
+}
+
+inline InputMask Rule::mask(byte i) const {
+    InputMask m = 0;
+    for (byte b = 0; b < MASK_SIZE; b++) m |= (InputMask)raw(i + b) << (8 * b);
+    return m;
+}
+
+// Политика объединения нескольких записей в один выход за цикл. Записи
+// сводятся по номерам правил, какого бы вида ни было правило
+enum : byte {
+    ARB_LAST = 0,                    // Побеждает последнее правило (по порядку add())
+    ARB_PRIORITY,                    // Побеждает первое правило
+    ARB_OR,                          // HIGH, если хотя бы одно правило требует HIGH
+    ARB_AND                          // HIGH, только если все правила требуют HIGH
+};
+
+// Запись таблицы LUT: какие выходы правила задают (drive) и в какое состояние (value).
+// Бит i соответствует outputs[i]
+struct LutEntry {
+    OutputMask value;
+    OutputMask drive;
 };
 
 // Компактный контроллер
 class EgLangController {
 public:
     Rule rules[MAX_RULES];
+#if EGLANG_ARENA_SIZE > 0
+    byte arena[EGLANG_ARENA_SIZE]; // Образы правил из add() подряд, без выравнивания
+#endif
+    word arenaUsed;              // Занято байт в arena[]
     byte count : 6;              // 6 бит для счетчика (до 63)
     byte currentRule : 6;        // 6 бит для текущего правила
     bool initialized : 1;        // 1 бит
+    bool lutMode : 1;            // 1 бит - условные правила через таблицу LUT
+    byte arbitration : 2;        // 2 бита - политика ARB_*
+    
+    // Последние состояния OUTPUT пинов: бит i - outputs[i]
+    OutputMask outputState;      // Записанное значение (0/1)
+    OutputMask outputDriven;     // Настроен ли как OUTPUT
+    
+    // Кадр выходов текущего цикла: правила только заполняют его,
+    // в конце цикла записываются лишь изменившиеся пины
+    OutputMask frameDrive;       // Выходы, которые задало хотя бы одно правило
+    OutputMask frameValue;       // Итоговое состояние после арбитража
+    byte frameRule[OUTPUT_COUNT]; // Правило, чья запись в кадре выигрывает при ARB_LAST/ARB_PRIORITY
+    byte requester;              // Правило, которое сейчас пишет в кадр
+    
+#if EGLANG_ANALOG
+    // ШИМ: выходы кадра со скважностью 1-254 и их скважности; 0 и 255 -
+    // обычные LOW и HIGH в frameValue
+    OutputMask framePwm;
+    byte frameDuty[OUTPUT_COUNT];
+    OutputMask outputPwm;        // Выходы, сейчас работающие в ШИМ
+    byte outputDuty[OUTPUT_COUNT];
+    
+    RuleMask analogRules;        // Условия по аналоговым каналам: проверяются каждый цикл
+    RuleMask pwmRules;           // Условные правила с действием ШИМ
+    byte analogChannels;         // Каналы, которые читают правила: бит n - An
+#if ANALOG_COUNT > 0
+    EgAnalogSampler analog;      // Выборка каналов этого контроллера
+#endif
+#endif
+    
+    // Владение выходами: owners[i] - условные правила, чье условие сейчас
+    // выполнено и которые задают outputs[i]. Меняется только при смене условия
+    RuleMask owners[OUTPUT_COUNT];
+    RuleMask highRules;          // Условные правила с действием HIGH
+    OutputMask releaseOutputs;   // Выходы, которые сбрасываются в LOW без владельцев
+    
+    // Инкрементальная оценка: за цикл проверяются только правила,
+    // чьи входы изменились, плюс "живые" (невыполненные простые команды
+    // и активные последовательности)
+    RuleMask dependents[INPUT_COUNT]; // Правила, читающие inputs[i]
+    RuleMask continuousRules;    // Условные правила
+    RuleMask liveRules;          // Проверяются каждый цикл
+    RuleMask heldRules;          // Активные циклы: пишут свои выходы в каждый кадр
+    RuleMask dirtyRules;         // Проверить в следующем цикле (после add()/reset())
+    InputMask lastSnapshot;      // Снимок входов предыдущей оценки
+    
+#if EGLANG_OPTIMIZE
+    // Общие термы (optimize()): терм из условий нескольких правил
+    // сравнивается один раз на снимок входов, итог до смены снимка - в кеше
+    InputMask sharedCare[EGLANG_SHARED_TERMS];
+    InputMask sharedValue[EGLANG_SHARED_TERMS];
+    byte sharedCount;
+    byte sharedKnown;            // Термы, уже сравненные на sharedSnapshot
+    byte sharedMet;              // Из них выполнены
+    InputMask sharedSnapshot;
+#endif
+    
+    // Колесо таймеров: timerSlots[i] - правила, чей таймер истекает в тик,
+    // попадающий в слот i. Обслуживание за цикл - O(истекших), а не O(правил)
+    RuleMask timerSlots[EGLANG_TIMER_SLOTS];
+    word timerTick;              // Последний обработанный тик
+    
+    // Планировщик poll(): период, дедлайн и статистика дрожания
+    unsigned long scanPeriodUs;  // Период цикла
+    unsigned long nextScanUs;    // Время следующего цикла
+    unsigned long lastScanUs;    // Начало предыдущего цикла
+    unsigned long scans;         // Выполнено циклов через poll()
+    word overruns;               // Циклы, опоздавшие на целый период и больше
+    long jitterLastUs;           // Отклонение последнего периода от заданного
+    unsigned long jitterMaxUs;   // Максимальное отклонение по модулю
     
-    // Хранение последних состояний OUTPUT пинов
-    struct PinState {
-        byte pin : 4;            // 4 бита для номера пина
-        byte state : 1;          // 1 бит для состояния (0/1)
-        byte isOutput : 1;       // 1 бит - настроен ли как OUTPUT
-    };
-    PinState pinStates[6];       // Состояния для 6 OUTPUT пинов
+    // Снимок входов за цикл: бит i = inputs[i] стабильно в LOW
+    InputMask inputSnapshot;
+    byte debounce[INPUT_COUNT];  // Интеграторы антидребезга (0..EGLANG_DEBOUNCE_MS)
+    InputMask settlingInputs;    // Входы, чей интегратор еще не дошел до уровня пина
+    unsigned long lastSampleMs;  // Время предыдущей выборки
     
+    EgLangController();          // Пустой набор; пины не трогает - это делает init()
     void init();
     bool add(const char* rule);
+    bool addFlash(const RuleImage* image);   // Образ в PROGMEM - без разбора и копии в SRAM
+    byte addProgram(const RuleImage* program, byte n); // Таблица RF(); возвращает число добавленных
     void run();
+    bool poll();                 // run(), если подошло время; иначе сразу false
+    void sleep();                // Сон до события на входе или до работы по времени (EGLANG_PCINT)
+    void setScanPeriod(unsigned long ms);
+    void resetSchedulerStats();
     void reset();
+    void clearRules();           // Удалить все правила; выходы сохраняют состояние
     void shutdown();             // Новый метод для завершения программы
-    bool readPinStable(byte pin); // Перенесено из Rule для общего использования
+    bool readPinStable(byte pin); // Стабильное состояние пина из снимка входов
+    bool readInput(byte index) { return (inputSnapshot >> index) & 1; }
+    void sampleInputs();         // Одна выборка всех входов в начале цикла
     void setPinOutput(byte pin, byte state); // ПЕРЕНЕСЕНО В PUBLIC
+    bool setOutput(byte index, byte state);  // То же по индексу в outputs[], true - пин изменился
+    void request(byte index, byte state);    // Запись в кадр текущего цикла (из правил)
+    void requestDuty(byte index, byte duty); // То же со скважностью 0-255 (EGLANG_ANALOG)
+    word analogValue(byte channel) const;    // Последнее значение канала An без ожидания АЦП
+    void updateOwner(byte rule, byte index, bool active); // Условие правила сменилось
+#if EGLANG_OPTIMIZE
+    bool sharedTermMet(byte terms, InputMask snapshot); // Выполнен хотя бы один из общих термов terms
+#endif
+    void armTimer(byte rule, word duration); // Таймер правила истекает через duration мс
+    void cancelTimer(byte rule);
+    void setArbitration(byte policy);        // ARB_LAST по умолчанию
+    
+    // Режим LUT: все условные правила сводятся к одной таблице на все снимки входов (до 8 входов).
+    // Простые команды и циклы по-прежнему выполняются правилами.
+    // Любой add() выключает режим до следующего compileLut()/useLut()
+    bool compileLut();                        // Строит таблицу в SRAM (нужен EGLANG_LUT)
+    bool useLut(const LutEntry* table);       // Готовая таблица в PROGMEM
+    LutEntry evaluateLut(InputMask snapshot); // Одна запись таблицы по правилам
+    void printLut(Print& out);                // Печать таблицы для PROGMEM
+    
+    // Статический анализ набора (EGLANG_OPTIMIZE=1), вызывать после загрузки правил:
+    // удаляет повторы, правила, перекрытые другими по арбитражу, и невыполнимые
+    // условия; в образах из SRAM ставит общие термы вперед, а термы, повторяющиеся
+    // в нескольких правилах, сравнивает раз на снимок входов. Выходы во всех сценариях те же, но номера правил меняются,
+    // а оставшиеся правила начинают как после add(). В out - строка на находку
+    bool optimize(Print* out = NULL, EgOptimizeReport* report = NULL);
+    
+    // Образ набора правил в EEPROM: заголовок с версией формата и подписью
+    // пинов, записи как в арене, контрольная сумма. loadImage() сначала
+    // проверяет весь образ и только затем заменяет правила - без разбора текста
+    bool saveImage(word address = EGLANG_EEPROM_ADDR);
+    bool loadImage(word address = EGLANG_EEPROM_ADDR);
+    
+    // Горячая замена набора правил: готовые записи (теневой банк EgRuleLoader)
+    // ставятся целиком в начале следующего run(), между циклами.
+    // Буфер records должен оставаться неизменным, пока swapPending()
+    bool stage(const byte* records, word size, byte n);
+    bool swapPending() const { return pendingRecords != NULL; }
+    
+    // Вывод накопленной трассировки - вызывать в свободное время
+    byte drainTrace();                       // В Serial, пока есть место в TX буфере
+    byte drainTrace(Print& out, byte maxEvents);
+    
+#if EGLANG_TRACE_LEVEL > 0
+    EgTrace trace;               // Кольцевой буфер событий
+#endif
+    
+    // Счетчики производительности (EGLANG_STATS=1): отчет текстом в out и сброс
+    void dumpStats(Print& out);
+    void resetStats();
+    
+#if EGLANG_STATS
+    EgStats stats;
+#endif
     
 private:
+#if EGLANG_LUT
+    LutEntry lut[LUT_SIZE];      // Таблица в SRAM
+#endif
+    const LutEntry* lutFlash;    // Таблица в PROGMEM или NULL
+    
+    const byte* pendingRecords;  // Набор для замены в начале цикла или NULL
+    word pendingSize;
+    
+    bool attach(const RuleImage* image, bool inFlash);
+    void attachArena(word size);
+#if EGLANG_OPTIMIZE
+    void rebuild(RuleMask drop);             // Заново подключает правила без drop, арена сжимается
+#endif
+    void installPending();
+    LutEntry lookupLut(InputMask snapshot);
+    void resolveOutput(RuleMask active, byte index, OutputMask& drive, OutputMask& value);
+    void mergeLut(LutEntry e);
+    void commitFrame();
+#if EGLANG_ANALOG
+    void combineDuty(byte index, byte duty, byte policy);
+    byte ownerDuty(RuleMask high);
+    OutputMask commitPwm();
+#endif
+    void checkRule(byte i);      // check() правила, со счетчиками при EGLANG_STATS
+    void updateLive(byte rule);
+    RuleMask dueTimers();        // Правила из слотов прошедших тиков
+    void leaveLut();
     void resetPinsToHighZ();
-    void updatePinState(byte pin, byte state);
-    void checkAndResetInactivePins(); // Новый метод для сброса неактивных пинов
 };
 
 extern EgLangController _eglang;
 
+#include "EgLangCompile.h"
+
 // Макросы (без изменений)
 #define AUTO_START \
     void _user_rules(); \
     void setup() { \
         _eglang.init(); \
-        _user_rules(); \
+        if (!EGLANG_EEPROM_BOOT || !_eglang.loadImage()) _user_rules(); \
+        _eglang.optimize(); \
+        _eglang.compileLut(); \
     } \
     void loop() { \
-        _eglang.run(); \
-        delay(50); \
+        if (!_eglang.poll()) { \
+            _eglang.drainTrace(); \
+            _eglang.sleep(); \
+        } \
     } \
     void _user_rules() {
 
 #define AUTO_END }
 
+// Правила, скомпилированные вместе со скетчем: таблица в PROGMEM,
+// ошибка в правиле - ошибка компиляции, при старте ничего не разбирается
+//   AUTO_START_FLASH
+//     RF("2,1")
+//     RF("?3,0!4,1")
+//   AUTO_END_FLASH
+#define AUTO_START_FLASH \
+    constexpr RuleImage _eglang_program[] PROGMEM = {
+
+#define RF(rule) egCompileRule(rule),
+
+#define AUTO_END_FLASH \
+    }; \
+    void setup() { \
+        _eglang.init(); \
+        if (!EGLANG_EEPROM_BOOT || !_eglang.loadImage()) \
+            _eglang.addProgram(_eglang_program, sizeof(_eglang_program) / sizeof(_eglang_program[0])); \
+        _eglang.optimize(); \
+        _eglang.compileLut(); \
+    } \
+    void loop() { \
+        if (!_eglang.poll()) { \
+            _eglang.drainTrace(); \
+            _eglang.sleep(); \
+        } \
+    }
+
 // Оптимизированный макрос R
 #define R(rule) _eglang.add(rule);
 
 // Компактные глобальные функции
 void addRule(const char* rule);
 void processRules();
+bool pollRules();                // Неблокирующий вариант для своего loop()
 void shutdownEgLang();           // Новая функция для завершения
 
 // Убираны избыточные функции для экономии памяти:
@@ -0,0 +1,96 @@
+#include "EgLangAnalog.h"
+
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+
+// Пины каналов A0, A1... профиля (PROGMEM, как inputs[] и outputs[])
+static const byte analogPins[] PROGMEM = { EGLANG_ANALOG_PINS };
+static_assert(sizeof(analogPins) == ANALOG_COUNT, "EGLANG_ANALOG_PINS does not match ANALOG_COUNT");
+
+// Следующий канал обхода после ch (по кругу)
+static byte nextChannel(byte channels, byte ch) {
+    for (byte k = 0; k < ANALOG_COUNT; k++) {
+        ch = (ch + 1 < ANALOG_COUNT) ? ch + 1 : 0;
+        if ((channels >> ch) & 1) break;
+    }
+    return ch;
+}
+
+#if defined(__AVR__)
+
+// Последние значения каналов; пишет прерывание АЦП
+static volatile word analogValues[ANALOG_COUNT];
+static byte analogChannels;          // Каналы в обходе: бит n - An
+
+// Свободный бег: следующее преобразование запускается сразу по окончании
+// текущего, с мультиплексором, выставленным до его запуска. Поэтому
+// результат в прерывании относится к каналу converting, а новый ADMUX -
+// к преобразованию после следующего (queued)
+static volatile byte converting;
+static volatile byte queued;
+
+static inline void selectChannel(byte ch) {
+    byte mux = pgm_read_byte(&analogPins[ch]) - A0;
+    ADMUX = _BV(REFS0) | (mux & 7);  // Опорное - AVcc
+#if defined(MUX5)
+    if (mux & 8) ADCSRB |= _BV(MUX5); else ADCSRB &= ~_BV(MUX5);
+#endif
+}
+
+ISR(ADC_vect) {
+    analogValues[converting] = ADC;
+    converting = queued;
+    queued = nextChannel(analogChannels, queued);
+    selectChannel(queued);
+}
+
+void EgAnalogSampler::start(byte channels) {
+    ADCSRA = 0;                      // Остановить бег и прерывание
+    analogChannels = channels;
+    if (!channels) return;
+    
+    // Первые два преобразования - первый канал, дальше по кругу
+    byte first = nextChannel(channels, ANALOG_COUNT - 1);
+    converting = first;
+    queued = first;
+    selectChannel(first);
+    ADCSRB &= ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0)); // Запуск - свободный бег
+    ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) |
+             _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);  // 16 МГц / 128 = 125 кГц
+}
+
+void EgAnalogSampler::poll() { }
+
+word EgAnalogSampler::read(byte channel) const {
+    byte sreg = SREG;
+    cli();
+    word value = analogValues[channel];
+    SREG = sreg;
+    return value;
+}
+
+#else
+
+// Без прерывания АЦП: один канал за цикл из sampleInputs()
+void EgAnalogSampler::start(byte mask) {
+    channels = mask;
+    polled = ANALOG_COUNT - 1;
+    
+    // Первые значения сразу, чтобы условия не видели нули
+    for (byte ch = 0; ch < ANALOG_COUNT; ch++) {
+        if ((mask >> ch) & 1) values[ch] = analogRead(pgm_read_byte(&analogPins[ch]));
+    }
+}
+
+void EgAnalogSampler::poll() {
+    if (!channels) return;
+    polled = nextChannel(channels, polled);
+    values[polled] = analogRead(pgm_read_byte(&analogPins[polled]));
+}
+
+word EgAnalogSampler::read(byte channel) const {
+    return values[channel];
+}
+
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef EGLANG_ANALOG_H
+#define EGLANG_ANALOG_H
+
+#include <Arduino.h>
+#include "EgLangPins.h"
+
+// Аналоговые условия "?A0>512!4,1" и ШИМ "9,=128" (флагом -D для всего проекта):
+// 0 - выключены, такие правила не разбираются
+// 1 - включены; на AVR библиотека занимает АЦП и его прерывание ADC_vect,
+//     поэтому analogRead() в скетче использовать нельзя
+#ifndef EGLANG_ANALOG
+#define EGLANG_ANALOG 0
+#endif
+static_assert(!EGLANG_ANALOG || ANALOG_COUNT > 0 || EGLANG_PWM_OUTPUTS, "EGLANG_ANALOG needs analog pins or PWM outputs in the board profile");
+
+// Гистерезис сравнения в единицах АЦП: "A0>512" включается выше 512
+// и выключается ниже 512 - EGLANG_ANALOG_HYSTERESIS (шум не дает дребезга)
+#ifndef EGLANG_ANALOG_HYSTERESIS
+#define EGLANG_ANALOG_HYSTERESIS 8
+#endif
+
+// Условие по каналу вместо термов: байт канала (биты 0-3, бит 7 - "<"),
+// затем порог (2 байта, младшим вперед)
+#define ANALOG_COND_SIZE 3
+#define ANALOG_BELOW 0x80
+
+#if EGLANG_ANALOG && ANALOG_COUNT > 0
+
+// Выборка в фоне: каналы из маски по кругу, последние значения - в
+// буфере. На AVR - АЦП в режиме свободного бега и прерывание по концу
+// преобразования (АЦП один, буфер общий для всех выборок); на остальных
+// платах - один analogRead() за цикл в буфер своего контроллера.
+// Чтение значения никогда не ждет преобразования
+class EgAnalogSampler {
+public:
+#if !defined(__AVR__)
+    EgAnalogSampler() : channels(0), polled(0) { memset(values, 0, sizeof(values)); }
+#endif
+    void start(byte channels);       // Бит n - канал An; 0 - остановить
+    void poll();                     // Следующий канал (без прерывания АЦП)
+    word read(byte channel) const;   // Последнее значение канала
+    
+#if !defined(__AVR__)
+private:
+    word values[ANALOG_COUNT];
+    byte channels;                   // Каналы в обходе: бит n - An
+    byte polled;                     // Последний прочитанный канал
+#endif
+};
+
+#endif
+
+// Сравнение с гистерезисом: on - условие выполнено в прошлой проверке
+inline bool egAnalogCompare(word value, word threshold, bool below, bool on) {
+    if (below) return on ? value <= (unsigned long)threshold + EGLANG_ANALOG_HYSTERESIS : value < threshold;
+    return on ? (unsigned long)value + EGLANG_ANALOG_HYSTERESIS >= threshold : value > threshold;
+}
+
+#endif
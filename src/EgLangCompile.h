@@ -0,0 +1,654 @@
+#ifndef EGLANG_COMPILE_H
+#define EGLANG_COMPILE_H
+
+// Компилятор правил времени компиляции (C++11 constexpr, без STL).
+// Подключается из EgLang.h. egCompileRule("?3,0!4,1") дает тот же RuleImage,
+// что и RuleImage::parse(), но вычисляется компилятором:
+//   constexpr RuleImage rules[] PROGMEM = { egCompileRule("2,1"), ... };
+// Неверное правило - ошибка компиляции "call to non-constexpr function
+// egInvalidRule" с текстом правила в цепочке constexpr-вызовов.
+// Номер пина - только цифры (parse() через atoi() допускает и " 2", "+2")
+
+// Вызывается только для неверного правила; определения нет намеренно
+RuleImage egInvalidRule(const char* rule);
+
+constexpr int egLength(const char* s, int i = 0) {
+    return s[i] ? egLength(s, i + 1) : i;
+}
+
+// Позиция первого символа c в [from, to) или -1
+constexpr int egFind(const char* s, char c, int from, int to) {
+    return from >= to ? -1 : (s[from] == c ? from : egFind(s, c, from + 1, to));
+}
+
+constexpr bool egIsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Номер пина из 1-2 цифр в [a, b) или -1
+constexpr int egNumber(const char* s, int a, int b) {
+    return (b - a == 1 && egIsDigit(s[a])) ? s[a] - '0' :
+           (b - a == 2 && egIsDigit(s[a]) && egIsDigit(s[a + 1])) ? (s[a] - '0') * 10 + (s[a + 1] - '0') :
+           -1;
+}
+
+constexpr int egIndexIn(const byte* pins, int n, int pin, int i = 0) {
+    return i >= n ? -1 : (pins[i] == pin ? i : egIndexIn(pins, n, pin, i + 1));
+}
+
+// Индекс пина в inputs[]/outputs[] или -1 (те же проверки, что в parse())
+constexpr int egPinIndex(int pin, bool output) {
+    return pin < 2 ? -1 :
+           output ? egIndexIn(egOutputPins, OUTPUT_COUNT, pin) : egIndexIn(egInputPins, INPUT_COUNT, pin);
+}
+
+// Пара "пин,состояние" ровно в [a, b): индекс пина или -1
+constexpr int egPairAt(const char* s, int a, int b, bool output, int comma) {
+    return (comma <= a || comma + 2 != b || (s[comma + 1] != '0' && s[comma + 1] != '1')) ? -1 :
+           egPinIndex(egNumber(s, a, comma), output);
+}
+
+constexpr int egPair(const char* s, int a, int b, bool output) {
+    return egPairAt(s, a, b, output, egFind(s, ',', a, b));
+}
+
+// Состояние пары (пара уже проверена): символ перед концом отрезка
+constexpr byte egPairState(const char* s, int b) {
+    return s[b - 1] == '1' ? 1 : 0;
+}
+
+constexpr InstrCode egInstr(byte op, int index, byte state) {
+    return egEncode(op, state, (byte)index);
+}
+
+// Байт b инструкции в записи (младшим вперед)
+constexpr byte egInstrByte(InstrCode code, int b) {
+    return (byte)(code >> (8 * b));
+}
+
+// Значение 1-5 цифр в [a, b) не больше 65535 или -1 (как parseDuration())
+constexpr long egDigitsValue(const char* s, int a, int b, long acc = 0) {
+    return a >= b ? acc : !egIsDigit(s[a]) ? -1 : egDigitsValue(s, a + 1, b, acc * 10 + (s[a] - '0'));
+}
+
+constexpr long egDurationOf(long value) {
+    return value > 0xFFFF ? -1 : value;
+}
+
+constexpr long egDuration(const char* s, int a, int b) {
+    return (b - a < 1 || b - a > 5) ? -1 : egDurationOf(egDigitsValue(s, a, b));
+}
+
+// ---- ШИМ "P,=D" (EGLANG_ANALOG) ----
+
+constexpr long egDutyOf(long value) {
+    return value > 255 ? -1 : value;
+}
+
+// Скважность "=D" с позиции a до b: 0-255 или -1 (как parseDuty())
+constexpr long egDutyAt(const char* s, int a, int b) {
+    return (!EGLANG_ANALOG || a >= b || s[a] != '=') ? -1 : egDutyOf(egDuration(s, a + 1, b));
+}
+
+// После запятой - '=': действие ШИМ, а не пара
+constexpr bool egPwmAt(const char* s, int a, int b, int comma) {
+    return comma > a && comma + 1 < b && s[comma + 1] == '=';
+}
+
+// Действие ШИМ в [a, b): индекс выхода с ШИМ или -1
+constexpr int egPwmPairAt(const char* s, int a, int b, int comma) {
+    return (egDutyAt(s, comma + 1, b) < 0 || !egPwmOutput(egPinIndex(egNumber(s, a, comma), true))) ? -1 :
+           egPinIndex(egNumber(s, a, comma), true);
+}
+
+// ---- Простая команда "P,S" или "P,=D" ----
+
+constexpr bool egSimplePwm(const char* s, int len) {
+    return egPwmAt(s, 0, len, egFind(s, ',', 0, len));
+}
+
+constexpr bool egSimpleValid(const char* s, int len) {
+    return egSimplePwm(s, len) ? egPwmPairAt(s, 0, len, egFind(s, ',', 0, len)) >= 0 : egPair(s, 0, len, true) >= 0;
+}
+
+constexpr long egSimpleDuty(const char* s, int len) {
+    return egDutyAt(s, egFind(s, ',', 0, len) + 1, len);
+}
+
+// Команда и у ШИМ скважность
+constexpr byte egSimpleByte(const char* s, int len, int k) {
+    return !egSimplePwm(s, len) ? egInstrByte(egInstr(OP_SET, egPair(s, 0, len, true), egPairState(s, len)), k) :
+           k < INSTR_SIZE ? egInstrByte(egInstr(OP_PWM, egPwmPairAt(s, 0, len, egFind(s, ',', 0, len)),
+                                                egSimpleDuty(s, len) != 0), k) :
+           (byte)egSimpleDuty(s, len);
+}
+
+// ---- Условие "?выражение!P,S", таймер "?выражение+мс!P,S", фронт "^выражение!P,S" ----
+// Действие "P,=D" - ШИМ, выражение "An>порог" - аналоговое условие (EGLANG_ANALOG)
+// Выражение: пары "P,S", ~ (НЕ), & (И), | (ИЛИ), скобки. Переменные - входы
+// условия по возрастанию индекса; значение - таблица истинности на 64 строках,
+// из которой жадно выбираются термы. parse() использует те же функции
+
+// Строка r таблицы - значения переменных: переменная k = бит k номера строки
+constexpr uint64_t egVarPattern(int k) {
+    return k == 0 ? 0xAAAAAAAAAAAAAAAAULL : k == 1 ? 0xCCCCCCCCCCCCCCCCULL :
+           k == 2 ? 0xF0F0F0F0F0F0F0F0ULL : k == 3 ? 0xFF00FF00FF00FF00ULL :
+           k == 4 ? 0xFFFF0000FFFF0000ULL : 0xFFFFFFFF00000000ULL;
+}
+
+// Строки, существующие при nv переменных
+constexpr uint64_t egRowMask(int nv) {
+    return nv >= 6 ? ~0ULL : (1ULL << (1 << nv)) - 1;
+}
+
+constexpr int egPopcount(uint64_t x) {
+    return x ? (x & 1) + egPopcount(x >> 1) : 0;
+}
+
+// Строки, где переменные из care равны битам value
+constexpr uint64_t egCube(int care, int value, int nv, int k = 0) {
+    return k >= nv ? ~0ULL :
+           (((care >> k) & 1) ? (((value >> k) & 1) ? egVarPattern(k) : ~egVarPattern(k)) : ~0ULL) &
+           egCube(care, value, nv, k + 1);
+}
+
+// Маска по переменным -> маска по входам (used - входы условия)
+constexpr uint64_t egSpread(int local, uint64_t used, int i = 0, int k = 0) {
+    return i >= INPUT_COUNT ? 0 :
+           ((used >> i) & 1) ? (((uint64_t)((local >> k) & 1) << i) | egSpread(local, used, i + 1, k + 1)) :
+           egSpread(local, used, i + 1, k);
+}
+
+constexpr int egDigitsEnd(const char* s, int p, int end) {
+    return (p < end && egIsDigit(s[p])) ? egDigitsEnd(s, p + 1, end) : p;
+}
+
+// Входы условия в [a, b): пины перед ','
+constexpr uint64_t egRunInput(const char* s, int i, int p, int b) {
+    return (p < b && s[p] == ',' && egPinIndex(egNumber(s, i, p), false) >= 0) ?
+           (1ULL << egPinIndex(egNumber(s, i, p), false)) : 0;
+}
+
+constexpr uint64_t egConditionInputs(const char* s, int i, int b);
+
+constexpr uint64_t egRunInputs(const char* s, int i, int p, int b) {
+    return egRunInput(s, i, p, b) | egConditionInputs(s, p, b);
+}
+
+constexpr uint64_t egConditionInputs(const char* s, int i, int b) {
+    return i >= b ? 0 :
+           !egIsDigit(s[i]) ? egConditionInputs(s, i + 1, b) :
+           egRunInputs(s, i, egDigitsEnd(s, i, b), b);
+}
+
+// Результат разбора части выражения
+struct EgExpr {
+    uint64_t table;
+    int pos;
+    bool ok;
+};
+
+constexpr EgExpr egExprFail() {
+    return EgExpr{ 0, 0, false };
+}
+
+constexpr uint64_t egLiteral(int var, bool state) {
+    return state ? egVarPattern(var) : ~egVarPattern(var);
+}
+
+constexpr EgExpr egAtom(const char* s, int pos, int end, uint64_t used, int p) {
+    return (p - pos < 1 || p - pos > 2 || p + 1 >= end || s[p] != ',' ||
+            (s[p + 1] != '0' && s[p + 1] != '1') || egPinIndex(egNumber(s, pos, p), false) < 0) ? egExprFail() :
+           EgExpr{ egLiteral(egPopcount(used & ((1ULL << egPinIndex(egNumber(s, pos, p), false)) - 1)), s[p + 1] == '1'),
+                   p + 2, true };
+}
+
+constexpr EgExpr egParseOr(const char* s, int pos, int end, uint64_t used);
+
+constexpr EgExpr egNegate(EgExpr e) {
+    return EgExpr{ ~e.table, e.pos, e.ok };
+}
+
+constexpr EgExpr egCloseParen(const char* s, int end, EgExpr e) {
+    return (e.ok && e.pos < end && s[e.pos] == ')') ? EgExpr{ e.table, e.pos + 1, true } : egExprFail();
+}
+
+constexpr EgExpr egParseUnary(const char* s, int pos, int end, uint64_t used) {
+    return pos >= end ? egExprFail() :
+           s[pos] == '~' ? egNegate(egParseUnary(s, pos + 1, end, used)) :
+           s[pos] == '(' ? egCloseParen(s, end, egParseOr(s, pos + 1, end, used)) :
+           egAtom(s, pos, end, used, egDigitsEnd(s, pos, end));
+}
+
+constexpr EgExpr egAndJoin(EgExpr a, EgExpr b) {
+    return b.ok ? EgExpr{ a.table & b.table, b.pos, true } : b;
+}
+
+constexpr EgExpr egAndTail(const char* s, int end, uint64_t used, EgExpr left) {
+    return (!left.ok || left.pos >= end || s[left.pos] != '&') ? left :
+           egAndTail(s, end, used, egAndJoin(left, egParseUnary(s, left.pos + 1, end, used)));
+}
+
+constexpr EgExpr egParseAnd(const char* s, int pos, int end, uint64_t used) {
+    return egAndTail(s, end, used, egParseUnary(s, pos, end, used));
+}
+
+constexpr EgExpr egOrJoin(EgExpr a, EgExpr b) {
+    return b.ok ? EgExpr{ a.table | b.table, b.pos, true } : b;
+}
+
+constexpr EgExpr egOrTail(const char* s, int end, uint64_t used, EgExpr left) {
+    return (!left.ok || left.pos >= end || s[left.pos] != '|') ? left :
+           egOrTail(s, end, used, egOrJoin(left, egParseAnd(s, left.pos + 1, end, used)));
+}
+
+constexpr EgExpr egParseOr(const char* s, int pos, int end, uint64_t used) {
+    return egOrTail(s, end, used, egParseAnd(s, pos, end, used));
+}
+
+// Жадное покрытие: первая непокрытая строка расширяется, пока куб
+// остается внутри on (переменные по порядку), и дает очередной терм.
+// Затем лишние термы (покрытые остальными) удаляются
+constexpr bool egCubeInside(uint64_t on, int care, int value, int nv) {
+    return (egCube(care, value, nv) & egRowMask(nv) & ~on) == 0;
+}
+
+constexpr int egExpand(uint64_t on, int nv, int m, int care, int b = 0) {
+    return b >= nv ? care :
+           egExpand(on, nv, m, egCubeInside(on, care & ~(1 << b), m & care & ~(1 << b), nv) ? (care & ~(1 << b)) : care, b + 1);
+}
+
+constexpr int egNextMinterm(uint64_t on, uint64_t covered, int nv, int m) {
+    return m >= (1 << nv) ? -1 :
+           ((((on >> m) & 1) && !((covered >> m) & 1)) ? m : egNextMinterm(on, covered, nv, m + 1));
+}
+
+// Терм по переменным
+struct EgTerm {
+    int care;
+    int value;
+    bool exists;
+};
+
+constexpr EgTerm egTermAt(uint64_t on, int nv, int k, uint64_t covered = 0, int from = 0);
+
+constexpr EgTerm egTermWith(uint64_t on, int nv, int k, uint64_t covered, int m, int care) {
+    return k == 0 ? EgTerm{ care, m & care, true } :
+           egTermAt(on, nv, k - 1, covered | egCube(care, m & care, nv), m + 1);
+}
+
+constexpr EgTerm egTermFrom(uint64_t on, int nv, int k, uint64_t covered, int m) {
+    return m < 0 ? EgTerm{ 0, 0, false } : egTermWith(on, nv, k, covered, m, egExpand(on, nv, m, (1 << nv) - 1));
+}
+
+constexpr EgTerm egTermAt(uint64_t on, int nv, int k, uint64_t covered, int from) {
+    return egTermFrom(on, nv, k, covered, egNextMinterm(on, covered, nv, from));
+}
+
+// Число термов жадного покрытия (счет останавливается после EGLANG_COND_CANDIDATES + 1)
+constexpr int egGreedyCount(uint64_t on, int nv, int k = 0) {
+    return (k <= EGLANG_COND_CANDIDATES && egTermAt(on, nv, k).exists) ? egGreedyCount(on, nv, k + 1) : k;
+}
+
+constexpr uint64_t egTermCube(EgTerm t, int nv) {
+    return egCube(t.care, t.value, nv) & egRowMask(nv);
+}
+
+// Объединение кубов термов из mask
+constexpr uint64_t egUnion(uint64_t on, int nv, int mask, int k = 0) {
+    return k >= EGLANG_COND_CANDIDATES ? 0 :
+           (((mask >> k) & 1) ? egTermCube(egTermAt(on, nv, k), nv) : 0) | egUnion(on, nv, mask, k + 1);
+}
+
+// Удаление лишних термов с конца: терм, покрытый остальными, выбрасывается
+constexpr int egPrune(uint64_t on, int nv, int kept, int k) {
+    return k < 0 ? kept :
+           egPrune(on, nv, (egTermCube(egTermAt(on, nv, k), nv) & ~egUnion(on, nv, kept & ~(1 << k))) == 0 ?
+                               (kept & ~(1 << k)) : kept, k - 1);
+}
+
+constexpr int egKeptOf(uint64_t on, int nv, int n) {
+    return egPrune(on, nv, (1 << n) - 1, n - 1);
+}
+
+// Маска оставленных термов (при n <= EGLANG_COND_CANDIDATES)
+constexpr int egKept(uint64_t on, int nv) {
+    return egKeptOf(on, nv, egGreedyCount(on, nv));
+}
+
+// Число термов условия; больше EGLANG_MAX_TERMS - правило неверно
+constexpr int egTermCount(uint64_t on, int nv) {
+    return egGreedyCount(on, nv) > EGLANG_COND_CANDIDATES ? EGLANG_MAX_TERMS + 1 : egPopcount(egKept(on, nv));
+}
+
+// Номер j-го установленного бита
+constexpr int egNthBit(int mask, int j, int i = 0) {
+    return ((mask >> i) & 1) ? (j == 0 ? i : egNthBit(mask, j - 1, i + 1)) : egNthBit(mask, j, i + 1);
+}
+
+// k-й терм условия после удаления лишних
+constexpr EgTerm egCondTerm(uint64_t on, int nv, int k) {
+    return egTermAt(on, nv, egNthBit(egKept(on, nv), k));
+}
+
+constexpr bool egIsLoop(const char* s, int len) {
+    return s[0] == '[' && s[len - 1] == ']';
+}
+
+constexpr bool egIsConditional(const char* s, int len) {
+    return !egIsLoop(s, len) && (s[0] == '?' || s[0] == '^');
+}
+
+constexpr int egExclamation(const char* s, int len) {
+    return egFind(s, '!', 0, len);
+}
+
+constexpr int egFirstOf(int a, int b) {
+    return a < 0 ? b : (b < 0 || a < b) ? a : b;
+}
+
+// Знак таймера (+, -, *) перед '!' или -1; у фронта таймера нет
+constexpr int egTimerMarkAt(const char* s, int excl) {
+    return egFirstOf(egFirstOf(egFind(s, '+', 1, excl), egFind(s, '-', 1, excl)), egFind(s, '*', 1, excl));
+}
+
+constexpr int egTimerMark(const char* s, int len) {
+    return s[0] == '^' ? -1 : egTimerMarkAt(s, egExclamation(s, len));
+}
+
+// Конец выражения условия
+constexpr int egConditionEnd(const char* s, int len) {
+    return egTimerMark(s, len) < 0 ? egExclamation(s, len) : egTimerMark(s, len);
+}
+
+// Запятая действия
+constexpr int egActionComma(const char* s, int len) {
+    return egFind(s, ',', egExclamation(s, len) + 1, len);
+}
+
+constexpr bool egActionPwm(const char* s, int len) {
+    return egPwmAt(s, egExclamation(s, len) + 1, len, egActionComma(s, len));
+}
+
+constexpr byte egActionOp(const char* s, int len) {
+    return s[0] == '^' ? (s[len - 1] == '~' ? OP_TOGGLE : OP_EDGE) :
+           egActionPwm(s, len) ? OP_PWM :
+           egTimerMark(s, len) < 0 ? OP_SET :
+           s[egTimerMark(s, len)] == '+' ? OP_TON :
+           s[egTimerMark(s, len)] == '-' ? OP_TOF : OP_PULSE;
+}
+
+// Пара действия в [a, b): у фронта состояние может быть '~'
+constexpr int egActionAt(const char* s, int a, int b, int comma, bool toggle) {
+    return (comma <= a || comma + 2 != b ||
+            (s[comma + 1] != '0' && s[comma + 1] != '1' && !(toggle && s[comma + 1] == '~'))) ? -1 :
+           egPinIndex(egNumber(s, a, comma), true);
+}
+
+// Индекс выхода действия; ШИМ - без фронта
+constexpr int egAction(const char* s, int len) {
+    return !egActionPwm(s, len) ?
+               egActionAt(s, egExclamation(s, len) + 1, len, egActionComma(s, len), s[0] == '^') :
+           s[0] == '^' ? -1 : egPwmPairAt(s, egExclamation(s, len) + 1, len, egActionComma(s, len));
+}
+
+constexpr long egActionDuty(const char* s, int len) {
+    return egDutyAt(s, egActionComma(s, len) + 1, len);
+}
+
+// Бит state инструкции действия: у ШИМ - скважность не 0
+constexpr byte egActionState(const char* s, int len) {
+    return egActionPwm(s, len) ? (egActionDuty(s, len) != 0) : egPairState(s, len);
+}
+
+constexpr int egTermStart(const char* s, int len) {
+    return egActionSize(egActionOp(s, len));
+}
+
+constexpr long egTimerDuration(const char* s, int len) {
+    return egDuration(s, egTimerMark(s, len) + 1, egExclamation(s, len));
+}
+
+constexpr uint64_t egUsed(const char* s, int len) {
+    return egConditionInputs(s, 1, egConditionEnd(s, len));
+}
+
+constexpr int egVars(const char* s, int len) {
+    return egPopcount(egUsed(s, len));
+}
+
+// Таблица истинности условия
+constexpr uint64_t egOn(const char* s, int len) {
+    return egParseOr(s, 1, egConditionEnd(s, len), egUsed(s, len)).table & egRowMask(egVars(s, len));
+}
+
+constexpr bool egExprComplete(EgExpr e, int end) {
+    return e.ok && e.pos == end;
+}
+
+// Аналоговое условие "An>порог" или "An<порог" в [1, end) (как parseAnalog())
+constexpr bool egIsAnalog(const char* s) {
+    return s[1] == 'A';
+}
+
+constexpr bool egAnalogValid(const char* s, int end) {
+    return EGLANG_ANALOG && end - 1 >= 4 && end - 1 <= 8 && egIsDigit(s[2]) && s[2] - '0' < ANALOG_COUNT &&
+           (s[3] == '>' || s[3] == '<') && egDuration(s, 4, end) >= 0;
+}
+
+// Байт канала (бит 7 - "<") и порог младшим вперед
+constexpr byte egAnalogByte(const char* s, int end, int k) {
+    return k == 0 ? (byte)((s[2] - '0') | (s[3] == '<' ? ANALOG_BELOW : 0)) :
+           k == 1 ? (byte)(egDuration(s, 4, end) & 0xFF) : (byte)(egDuration(s, 4, end) >> 8);
+}
+
+constexpr bool egExpressionValid(const char* s, int len, int end) {
+    return egPopcount(egConditionInputs(s, 1, end)) <= EGLANG_COND_VARS &&
+           egExprComplete(egParseOr(s, 1, end, egConditionInputs(s, 1, end)), end) &&
+           egTermCount(egOn(s, len), egVars(s, len)) <= EGLANG_MAX_TERMS;
+}
+
+constexpr bool egConditionalValidAt(const char* s, int len, int excl, int end) {
+    return excl > 1 &&
+           egAction(s, len) >= 0 &&
+           (egTimerMark(s, len) < 0 || (!egActionPwm(s, len) && egTimerDuration(s, len) >= 0)) &&
+           (egIsAnalog(s) ? egAnalogValid(s, end) : egExpressionValid(s, len, end));
+}
+
+constexpr bool egConditionalValid(const char* s, int len) {
+    return egConditionalValidAt(s, len, egExclamation(s, len), egConditionEnd(s, len));
+}
+
+constexpr int egTermBytes(const char* s, int len) {
+    return egIsAnalog(s) ? ANALOG_COND_SIZE : TERM_SIZE * egTermCount(egOn(s, len), egVars(s, len));
+}
+
+// k-й байт: действие, длительность таймера или скважность, затем пары
+// масок care/value по входам (MASK_SIZE байт, младшим вперед) или
+// аналоговое условие
+constexpr byte egTermByte(EgTerm t, uint64_t used, bool care, int b) {
+    return (byte)(egSpread(care ? t.care : t.value, used) >> (8 * b));
+}
+
+constexpr byte egConditionalTermByte(const char* s, int len, int k) {
+    return egIsAnalog(s) ? egAnalogByte(s, egConditionEnd(s, len), k) :
+           egTermByte(egCondTerm(egOn(s, len), egVars(s, len), k / TERM_SIZE), egUsed(s, len),
+                      k % TERM_SIZE < MASK_SIZE, k % MASK_SIZE);
+}
+
+constexpr byte egConditionalByte(const char* s, int len, int k) {
+    return k < INSTR_SIZE ? egInstrByte(egInstr(egActionOp(s, len), egAction(s, len), egActionState(s, len)), k) :
+           k >= egTermStart(s, len) ? egConditionalTermByte(s, len, k - egTermStart(s, len)) :
+           egActionPwm(s, len) ? (byte)egActionDuty(s, len) :
+           k == INSTR_SIZE ? (byte)(egTimerDuration(s, len) & 0xFF) : (byte)(egTimerDuration(s, len) >> 8);
+}
+
+// ---- Цикл "[P:P,S;P,S...]" и последовательность "[P:P,S@мс;P,S@мс...]" ----
+
+constexpr int egColon(const char* s, int len) {
+    return egFind(s, ':', 1, len);
+}
+
+// Конец команды, начинающейся с a: позиция ';' или end
+constexpr int egCommandEnd(const char* s, int a, int end) {
+    return egFind(s, ';', a, end) < 0 ? end : egFind(s, ';', a, end);
+}
+
+// Команда в [a, e): "P,S" или "P,S@мс"
+constexpr bool egStepValidAt(const char* s, int a, int e, int at) {
+    return at < 0 ? egPair(s, a, e, true) >= 0 :
+           (egPair(s, a, at, true) >= 0 && egDuration(s, at + 1, e) >= 0);
+}
+
+constexpr bool egStepValid(const char* s, int a, int e) {
+    return egStepValidAt(s, a, e, egFind(s, '@', a, e));
+}
+
+// Все команды - пары выходов; пустой допускается только последний
+// отрезок (завершающая ';'), как в RuleImage::parseLoopCommands()
+constexpr bool egCommandsValidTo(const char* s, int a, int e, int end);
+
+constexpr bool egCommandsValid(const char* s, int a, int end) {
+    return egCommandsValidTo(s, a, egCommandEnd(s, a, end), end);
+}
+
+constexpr bool egCommandsValidTo(const char* s, int a, int e, int end) {
+    return e == end ? (a == end || egStepValid(s, a, end)) :
+           (egStepValid(s, a, e) && egCommandsValid(s, e + 1, end));
+}
+
+constexpr int egCommandCount(const char* s, int a, int end) {
+    return a >= end ? 0 : 1 + egCommandCount(s, egCommandEnd(s, a, end) + 1, end);
+}
+
+constexpr int egCommandStart(const char* s, int a, int end, int k) {
+    return k == 0 ? a : egCommandStart(s, egCommandEnd(s, a, end) + 1, end, k - 1);
+}
+
+// Есть длительность хотя бы у одного шага
+constexpr bool egLoopTimed(const char* s, int len) {
+    return egFind(s, '@', egColon(s, len) + 1, len - 1) >= 0;
+}
+
+constexpr bool egLoopValidAt(const char* s, int len, int colon) {
+    return len >= 5 && colon > 0 && colon < len - 2 &&
+           egPinIndex(egNumber(s, 1, colon), false) >= 0 &&
+           (len - 1) - (colon + 1) < MAX_LOOP_COMMANDS &&
+           egCommandsValid(s, colon + 1, len - 1) &&
+           (!egLoopTimed(s, len) || egCommandCount(s, colon + 1, len - 1) <= MAX_SEQUENCE_STEPS);
+}
+
+constexpr bool egLoopValid(const char* s, int len) {
+    return egLoopValidAt(s, len, egColon(s, len));
+}
+
+// Конец пары команды: '@' или конец команды
+constexpr int egPairEndAt(int at, int e) {
+    return at < 0 ? e : at;
+}
+
+constexpr int egPairEnd(const char* s, int a, int end) {
+    return egPairEndAt(egFind(s, '@', a, egCommandEnd(s, a, end)), egCommandEnd(s, a, end));
+}
+
+constexpr InstrCode egCommandInstr(const char* s, int a, int end) {
+    return egInstr(OP_SET, egPair(s, a, egPairEnd(s, a, end), true), egPairState(s, egPairEnd(s, a, end)));
+}
+
+// Длительность шага, начинающегося с a (0 - без '@')
+constexpr long egStepDuration(const char* s, int a, int end) {
+    return egPairEnd(s, a, end) == egCommandEnd(s, a, end) ? 0 :
+           egDuration(s, egPairEnd(s, a, end) + 1, egCommandEnd(s, a, end));
+}
+
+// Байт part шага: команда, младший и старший байт длительности
+constexpr byte egStepByte(const char* s, int a, int end, int part) {
+    return part < INSTR_SIZE ? egInstrByte(egCommandInstr(s, a, end), part) :
+           part == INSTR_SIZE ? (byte)(egStepDuration(s, a, end) & 0xFF) : (byte)(egStepDuration(s, a, end) >> 8);
+}
+
+constexpr InstrCode egLoopInstrAt(const char* s, int len, int k, int colon) {
+    return k == 0 ? egInstr(OP_LOOP, egPinIndex(egNumber(s, 1, colon), false), 1) :
+           egCommandInstr(s, egCommandStart(s, colon + 1, len - 1, k - 1), len - 1);
+}
+
+constexpr InstrCode egLoopInstr(const char* s, int len, int k) {
+    return egLoopInstrAt(s, len, k, egColon(s, len));
+}
+
+constexpr byte egSequenceByteAt(const char* s, int len, int k, int colon) {
+    return k < INSTR_SIZE ? egInstrByte(egInstr(OP_LOOP, egPinIndex(egNumber(s, 1, colon), false), 1), k) :
+           egStepByte(s, egCommandStart(s, colon + 1, len - 1, (k - INSTR_SIZE) / STEP_SIZE), len - 1,
+                      (k - INSTR_SIZE) % STEP_SIZE);
+}
+
+constexpr byte egLoopByte(const char* s, int len, int k) {
+    return egLoopTimed(s, len) ? egSequenceByteAt(s, len, k, egColon(s, len)) :
+           egInstrByte(egLoopInstr(s, len, k / INSTR_SIZE), k % INSTR_SIZE);
+}
+
+// Есть ли команда, отличная от первой (как detectAlternating())
+constexpr bool egLoopAlternating(const char* s, int len, int n, int k = 2) {
+    return k > n ? false :
+           (egLoopInstr(s, len, k) != egLoopInstr(s, len, 1) || egLoopAlternating(s, len, n, k + 1));
+}
+
+constexpr int egLoopCommands(const char* s, int len) {
+    return egCommandCount(s, egColon(s, len) + 1, len - 1);
+}
+
+// ---- Правило целиком ----
+
+constexpr byte egKind(const char* s, int len) {
+    return egIsLoop(s, len) ? (egLoopTimed(s, len) ? RULE_SEQUENCE : RULE_LOOP) :
+           egIsConditional(s, len) ? RULE_CONDITIONAL : RULE_SIMPLE;
+}
+
+constexpr bool egRuleValid(const char* s, int len) {
+    return len >= 3 && len < MAX_RULE_LENGTH &&
+           (egIsLoop(s, len) ? egLoopValid(s, len) :
+            egIsConditional(s, len) ? egConditionalValid(s, len) : egSimpleValid(s, len));
+}
+
+constexpr int egCodeLength(const char* s, int len) {
+    return egIsLoop(s, len) ? INSTR_SIZE + (egLoopTimed(s, len) ? STEP_SIZE : INSTR_SIZE) * egLoopCommands(s, len) :
+           egIsConditional(s, len) ? egTermStart(s, len) + egTermBytes(s, len) :
+           INSTR_SIZE + (egSimplePwm(s, len) ? 1 : 0);
+}
+
+constexpr RuleImage::Header egHeader(const char* s, int len) {
+    return RuleImage::Header{
+        egKind(s, len),
+        (byte)(egIsLoop(s, len) && !egLoopTimed(s, len) && egLoopAlternating(s, len, egLoopCommands(s, len))),
+        1,
+        (byte)egCodeLength(s, len)
+    };
+}
+
+constexpr byte egByteAt(const char* s, int len, int k) {
+    return k >= egCodeLength(s, len) ? 0 :
+           egIsLoop(s, len) ? egLoopByte(s, len, k) :
+           egIsConditional(s, len) ? egConditionalByte(s, len, k) :
+           egSimpleByte(s, len, k);
+}
+
+// Последовательность 0..N-1 для заполнения code[] (аналог index_sequence)
+template <int... I> struct EgIndices { };
+template <int N, int... I> struct EgMakeIndices : EgMakeIndices<N - 1, N - 1, I...> { };
+template <int... I> struct EgMakeIndices<0, I...> { typedef EgIndices<I...> type; };
+
+template <int... I>
+constexpr RuleImage egBuildRule(const char* s, int len, EgIndices<I...>) {
+    return RuleImage{ egHeader(s, len), { egByteAt(s, len, I)... } };
+}
+
+constexpr RuleImage egCompileRuleOf(const char* s, int len) {
+    return egRuleValid(s, len) ? egBuildRule(s, len, EgMakeIndices<MAX_RULE_CODE>::type()) :
+                                 egInvalidRule(s);
+}
+
+constexpr RuleImage egCompileRule(const char* rule) {
+    return egCompileRuleOf(rule, egLength(rule));
+}
+
+#endif
@@ -0,0 +1,117 @@
+#include "EgLangLoader.h"
+
+EgRuleLoader::EgRuleLoader(EgLangController& target)
+    : errorLine(0), loaded(0), target(target), status(LOADER_IDLE),
+      lineLength(0), overflow(false), lineNumber(0),
+      shadowUsed(0), shadowCount(0), reply(NULL) {
+}
+
+byte EgRuleLoader::state() {
+    // Замена выполнена - теневой банк снова свободен
+    if (status == LOADER_PENDING && !target.swapPending()) status = LOADER_IDLE;
+    return status;
+}
+
+byte EgRuleLoader::poll(Stream& io) {
+    reply = &io;
+    while (io.available() > 0) {
+        if (state() == LOADER_PENDING) break;
+        feed((char)io.read());
+    }
+    reply = NULL;
+    return state();
+}
+
+bool EgRuleLoader::feed(char c) {
+    if (state() == LOADER_PENDING) return false;
+    
+    if (c == '\r') return true;
+    if (c == '\n') {
+        endLine();
+        return true;
+    }
+    
+    if (lineLength < MAX_RULE_LENGTH - 1) {
+        line[lineLength++] = c;
+    } else {
+        overflow = true;
+    }
+    return true;
+}
+
+void EgRuleLoader::abort() {
+    if (status != LOADER_PENDING) status = LOADER_IDLE;
+    lineLength = 0;
+    overflow = false;
+}
+
+// Конец строки: команда END, пропуск или правило
+void EgRuleLoader::endLine() {
+    line[lineLength] = '\0';
+    bool empty = (lineLength == 0 || line[0] == '#');
+    bool end = !overflow && strcmp(line, "END") == 0;
+    
+    if (status == LOADER_IDLE && !empty) {
+        // Первая значимая строка начинает новую программу
+        status = LOADER_RECEIVING;
+        lineNumber = 0;
+        shadowUsed = 0;
+        shadowCount = 0;
+    }
+    if (status != LOADER_IDLE) lineNumber++;
+    
+    if (end) {
+        finish();
+    } else if (!empty && status == LOADER_RECEIVING) {
+        compileLine();
+    }
+    
+    lineLength = 0;
+    overflow = false;
+}
+
+// Правило сразу в запись теневого банка
+void EgRuleLoader::compileLine() {
+    RuleImage image;
+    if (overflow || !image.parse(line)) {
+        fail();
+        return;
+    }
+    
+    byte size = image.size();
+    if (shadowCount >= MAX_RULES || shadowUsed + size > EGLANG_SHADOW_SIZE) {
+        fail();
+        return;
+    }
+    
+    memcpy(&shadow[shadowUsed], &image, size);
+    shadowUsed += size;
+    shadowCount++;
+}
+
+void EgRuleLoader::finish() {
+    if (status == LOADER_RECEIVING && shadowCount > 0 &&
+        target.stage(shadow, shadowUsed, shadowCount)) {
+        status = LOADER_PENDING;
+        errorLine = 0;
+        loaded++;
+        if (reply) {
+            reply->print("OK ");
+            reply->println(shadowCount);
+        }
+        return;
+    }
+    
+    // Пустая программа или не помещается в арену контроллера
+    if (status == LOADER_RECEIVING) errorLine = lineNumber;
+    status = LOADER_IDLE;
+    if (reply) {
+        reply->print("ERR ");
+        reply->println(errorLine);
+    }
+}
+
+void EgRuleLoader::fail() {
+    status = LOADER_FAILED;
+    errorLine = lineNumber;
+}
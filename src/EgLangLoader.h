@@ -0,0 +1,66 @@
+#ifndef EGLANG_LOADER_H
+#define EGLANG_LOADER_H
+
+#include "EgLang.h"
+
+// Теневой банк загрузчика: скомпилированные записи новой программы
+#ifndef EGLANG_SHADOW_SIZE
+#define EGLANG_SHADOW_SIZE EGLANG_ARENA_SIZE
+#endif
+
+// Состояние загрузчика
+enum : byte {
+    LOADER_IDLE = 0,                 // Ждет программу
+    LOADER_RECEIVING,                // Принимает строки правил
+    LOADER_FAILED,                   // Ошибка в программе, пропускает строки до END
+    LOADER_PENDING                   // Программа проверена, замена в начале цикла
+};
+
+// Потоковый загрузчик правил. Программа - по правилу в строке, завершается
+// строкой END; пустые строки и строки с '#' пропускаются:
+//   ?3,0!4,1
+//   [5:6,1@250;6,0@250]
+//   END
+// Правило компилируется сразу по концу строки в теневой банк, в памяти
+// только одна строка текста. Живой набор заменяется лишь целиком
+// проверенной программой и только на границе цикла run()
+class EgRuleLoader {
+public:
+    explicit EgRuleLoader(EgLangController& target = _eglang);
+    
+    // Все доступные байты без ожидания. Ответ в поток: "OK n" - программа
+    // принята, "ERR строка" - отклонена. Пока замена не выполнена, байты
+    // не читаются и остаются в буфере потока
+    byte poll(Stream& io);
+    
+    // Один символ; false - символ не принят (ждет замены), повторить позже
+    bool feed(char c);
+    
+    void abort();                    // Сбросить принимаемую программу
+    byte state();
+    
+    word errorLine;                  // Строка последней ошибки (0 - не было)
+    word loaded;                     // Принято программ
+    
+private:
+    EgLangController& target;
+    byte status;
+    
+    char line[MAX_RULE_LENGTH];      // Текущая строка
+    byte lineLength : 6;
+    bool overflow : 1;               // Строка длиннее MAX_RULE_LENGTH
+    word lineNumber;
+    
+    byte shadow[EGLANG_SHADOW_SIZE]; // Записи новой программы подряд
+    word shadowUsed;
+    byte shadowCount;
+    
+    Print* reply;                    // Куда отвечать (только из poll())
+    
+    void endLine();
+    void compileLine();
+    void finish();
+    void fail();
+};
+
+#endif
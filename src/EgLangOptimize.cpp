@@ -0,0 +1,400 @@
+#include "EgLang.h"
+
+// Статический анализ набора правил: что можно удалить, не меняя выходов
+// ни в одном сценарии входов, и как сократить работу оставшихся.
+// Рассуждения ниже опираются на run(): условные правила с уровнем (SET, ШИМ)
+// владеют выходом, фронты, таймеры, циклы и простые команды пишут в кадр, и
+// resolveOutput() сводит все записи цикла по номерам правил
+
+#if EGLANG_OPTIMIZE
+
+static byte countBits(InputMask m) {
+    byte n = 0;
+    for (; m; m &= m - 1) n++;
+    return n;
+}
+
+// Условие из термов по входам (у аналогового условия термов нет)
+static bool hasTerms(const Rule& r) {
+    if (r.header.kind != RULE_CONDITIONAL) return false;
+#if EGLANG_ANALOG
+    if (r.analogCondition()) return false;
+#endif
+    return true;
+}
+
+// Терм a выполняется только вместе с термом b: b требует части того же
+static bool termWithin(InputMask careA, InputMask valueA, InputMask careB, InputMask valueB) {
+    return !(careB & ~careA) && (valueA & careB) == valueB;
+}
+
+// Условие a выполняется только вместе с b. Достаточная проверка: каждый
+// терм a лежит внутри одного терма b (покрытие несколькими не ищется)
+static bool implies(const Rule& a, const Rule& b) {
+    for (byte i = a.termStart(); i + TERM_SIZE <= a.header.length; i += TERM_SIZE) {
+        bool inside = false;
+        for (byte j = b.termStart(); j + TERM_SIZE <= b.header.length && !inside; j += TERM_SIZE) {
+            inside = termWithin(a.mask(i), a.mask(i + MASK_SIZE), b.mask(j), b.mask(j + MASK_SIZE));
+        }
+        if (!inside) return false;
+    }
+    return true;
+}
+
+// Есть снимок входов, на котором выполнены оба условия
+static bool overlaps(const Rule& a, const Rule& b) {
+    for (byte i = a.termStart(); i + TERM_SIZE <= a.header.length; i += TERM_SIZE) {
+        for (byte j = b.termStart(); j + TERM_SIZE <= b.header.length; j += TERM_SIZE) {
+            InputMask both = a.mask(i) & b.mask(j);
+            if (!((a.mask(i + MASK_SIZE) ^ b.mask(j + MASK_SIZE)) & both)) return true;
+        }
+    }
+    return false;
+}
+
+// Побайтно одинаковые записи (заголовок выводится из кода)
+static bool sameRule(const Rule& a, const Rule& b) {
+    if (a.header.kind != b.header.kind || a.header.length != b.header.length) return false;
+    for (byte k = 0; k < a.header.length; k++) {
+        if (a.raw(k) != b.raw(k)) return false;
+    }
+    return true;
+}
+
+// Ожидаемое число сравнений термов за проверку в 1/256: до терма k
+// доходит проверка, если не выполнился ни один из предыдущих. Общие
+// термы (бит в sharedAt) проверяются первыми и берутся из кеша: они
+// сокращают проверку, но сравнений в правиле не стоят
+static word expectedTests(const Rule& r) {
+    if (!hasTerms(r)) return 0;
+    word reach = 256;
+    word tests = 0;
+    for (byte pass = 0; pass < 2; pass++) {
+        byte term = 0;
+        for (byte k = r.termStart(); k + TERM_SIZE <= r.header.length; k += TERM_SIZE, term++) {
+            bool shared = (r.sharedAt >> term) & 1;
+            if (shared != (pass == 0)) continue;
+            if (!shared) tests += reach;
+            byte cares = countBits(r.mask(k));
+            if (cares < 16) reach -= reach >> cares;
+        }
+    }
+    return tests;
+}
+
+// Проверок правила на проход по входам и сравнений термов в них (в 1/256)
+static void addCost(const Rule& r, unsigned long& checks, unsigned long& tests) {
+    byte n = countBits(r.inputMask());
+    checks += n;
+    tests += (unsigned long)n * expectedTests(r);
+}
+
+// Терм care/value среди необщих термов правила: его номер или -1
+static int findTerm(const Rule& r, InputMask care, InputMask value) {
+    if (!hasTerms(r)) return -1;
+    byte term = 0;
+    for (byte k = r.termStart(); k + TERM_SIZE <= r.header.length; k += TERM_SIZE, term++) {
+        if (((r.sharedAt >> term) & 1) == 0 && r.mask(k) == care && r.mask(k + MASK_SIZE) == value) return term;
+    }
+    return -1;
+}
+
+static word saturate(unsigned long v) {
+    return v > 0xFFFF ? 0xFFFF : (word)v;
+}
+
+static void printFinding(Print* out, const char* what, byte rule, const char* sep, int other) {
+    if (!out) return;
+    out->print("OPT "); out->print(what); out->print(' '); out->print(rule);
+    if (sep) {
+        out->print(sep); out->print(other);
+    }
+    out->println();
+}
+
+#endif
+
+bool EgLangController::optimize(Print* out, EgOptimizeReport* report) {
+#if EGLANG_OPTIMIZE
+    EgOptimizeReport rep;
+    memset(&rep, 0, sizeof(rep));
+    rep.rulesBefore = count;
+    
+    unsigned long checks = 0, tests = 0;
+    for (byte i = 0; i < count; i++) addCost(rules[i], checks, tests);
+    rep.checksBefore = saturate(checks);
+    rep.testsBefore = saturate(tests >> 8);
+    
+    // Простые команды идут по currentRule с начала и встают на первом
+    // правиле другого вида: его удаление сдвинуло бы остановку
+    byte anchor = 0;
+    while (anchor < count && rules[anchor].header.kind == RULE_SIMPLE) anchor++;
+    
+    RuleMask drop = 0;
+    
+    // Условие без термов не выполняется никогда: правило не владеет
+    // выходом и не пишет его (отпускание выхода сохраняет rebuild())
+    for (byte i = 0; i < count; i++) {
+        if (i == anchor || !hasTerms(rules[i])) continue;
+        if (rules[i].header.length == rules[i].termStart()) {
+            drop |= (RuleMask)1 << i;
+            rep.never++;
+            printFinding(out, "never", i, NULL, 0);
+        } else if (rules[i].header.length - rules[i].termStart() == TERM_SIZE && !rules[i].mask(rules[i].termStart())) {
+            printFinding(out, "always", i, NULL, 0);
+        }
+    }
+    
+    // Повторы условного правила: одинаковое состояние, одинаковые записи
+    // в одном и том же цикле. Остается то, что выигрывает арбитраж: при
+    // ARB_LAST - последнее, иначе первое
+    for (byte i = 0; i < count; i++) {
+        if (((drop >> i) & 1) || rules[i].header.kind != RULE_CONDITIONAL) continue;
+        for (byte j = i + 1; j < count; j++) {
+            if (((drop >> j) & 1) || !sameRule(rules[i], rules[j])) continue;
+            byte gone = (arbitration == ARB_LAST) ? i : j;
+            if (gone == anchor) continue;
+            drop |= (RuleMask)1 << gone;
+            rep.duplicates++;
+            printFinding(out, "dup", gone, " = ", gone == i ? j : i);
+            if (gone == i) break;
+        }
+    }
+    
+    // Перекрытые правила одного выхода: когда выполнено условие c,
+    // выполнено и условие s, и resolveOutput() получает тот же итог без c.
+    // PRIORITY - s раньше; LAST - s позже; OR и AND - c не влияет на итог
+    // (LOW при OR, HIGH при AND) или s того же состояния. Скважность при OR
+    // и AND сводится по всем владельцам - там правила с ШИМ не трогаются
+    for (byte c = 0; c < count; c++) {
+        RuleMask cbit = (RuleMask)1 << c;
+        if ((drop & cbit) || c == anchor || !(continuousRules & cbit) || !hasTerms(rules[c])) continue;
+        byte output = rules[c].action().index;
+        bool cHigh = (highRules & cbit) != 0;
+        
+        for (byte s = 0; s < count; s++) {
+            RuleMask sbit = (RuleMask)1 << s;
+            if (s == c || (drop & sbit) || !(continuousRules & sbit) || !hasTerms(rules[s])) continue;
+            if (rules[s].action().index != output) continue;
+        
+            bool sHigh = (highRules & sbit) != 0;
+            bool allowed;
+            switch (arbitration) {
+                case ARB_PRIORITY: allowed = s < c; break;
+                case ARB_LAST:     allowed = s > c; break;
+                case ARB_OR:       allowed = !cHigh || sHigh; break;
+                default:           allowed = cHigh || !sHigh; break;
+            }
+#if EGLANG_ANALOG
+            if ((arbitration == ARB_OR || arbitration == ARB_AND) && ((cbit | sbit) & pwmRules)) allowed = false;
+#endif
+            if (!allowed || !implies(rules[c], rules[s])) continue;
+        
+            drop |= cbit;
+            rep.shadowed++;
+            printFinding(out, "shadow", c, " by ", s);
+            break;
+        }
+    }
+    
+    // Противоречия: два правила задают выходу разные состояния при одном
+    // снимке - итог решает политика арбитража. Только отчет
+    for (byte i = 0; i < count; i++) {
+        RuleMask ibit = (RuleMask)1 << i;
+        if ((drop & ibit) || !(continuousRules & ibit) || !hasTerms(rules[i])) continue;
+        for (byte j = i + 1; j < count; j++) {
+            RuleMask jbit = (RuleMask)1 << j;
+            if ((drop & jbit) || !(continuousRules & jbit) || !hasTerms(rules[j])) continue;
+            if (rules[i].action().index != rules[j].action().index) continue;
+            if (!(highRules & ibit) == !(highRules & jbit) || !overlaps(rules[i], rules[j])) continue;
+        
+            rep.conflicts++;
+            if (out) {
+                out->print("OPT conflict "); out->print(i); out->print(' '); out->print(j);
+                out->print(" pin "); out->println(pgm_read_byte(&outputs[rules[i].action().index]));
+            }
+        }
+    }
+
+#if EGLANG_ARENA_SIZE > 0
+    // Термы образов в арене: самые общие (меньше входов) первыми - проверка
+    // условия останавливается на первом выполненном терме. Поглощенных
+    // термов не бывает: parse() оставляет неизбыточное покрытие
+    for (byte i = 0; i < count; i++) {
+        Rule& r = rules[i];
+        if (((drop >> i) & 1) || r.inFlash || !hasTerms(r)) continue;
+        if ((const byte*)r.image < arena || (const byte*)r.image >= arena + EGLANG_ARENA_SIZE) continue;
+        
+        byte start = r.termStart();
+        byte terms = (r.header.length - start) / TERM_SIZE;
+        byte order[EGLANG_MAX_TERMS];
+        byte cares[EGLANG_MAX_TERMS];
+        if (terms > EGLANG_MAX_TERMS) continue;
+        
+        // Вставка с сохранением порядка равных
+        bool moved = false;
+        for (byte k = 0; k < terms; k++) {
+            byte c = countBits(r.mask(start + k * TERM_SIZE));
+            byte p = k;
+            while (p > 0 && cares[p - 1] > c) {
+                order[p] = order[p - 1];
+                cares[p] = cares[p - 1];
+                p--;
+            }
+            order[p] = k;
+            cares[p] = c;
+            moved |= (p != k);
+        }
+        if (!moved) continue;
+        
+        byte code[MAX_COND_CODE];
+        for (byte p = 0; p < terms; p++) {
+            memcpy(&code[p * TERM_SIZE], &r.image->code[start + order[p] * TERM_SIZE], TERM_SIZE);
+        }
+        memcpy(&((RuleImage*)r.image)->code[start], code, terms * TERM_SIZE);
+        rep.termsReordered++;
+        printFinding(out, "order", i, NULL, 0);
+    }
+#endif
+    
+    word used = arenaUsed;
+    if (drop) rebuild(drop);
+    rep.arenaFreed = used - arenaUsed;
+    rep.rulesAfter = count;
+    
+    // Общие термы: терм, который есть в условиях нескольких правил,
+    // сравнивается раз на снимок входов (sharedTermMet()), а в образах
+    // правил пропускается. В таблицу по очереди идет самый частый терм
+    sharedCount = 0;
+    sharedKnown = 0;
+    for (byte i = 0; i < count; i++) {
+        rules[i].sharedTerms = 0;
+        rules[i].sharedAt = 0;
+    }
+    while (sharedCount < EGLANG_SHARED_TERMS) {
+        byte best = 1;
+        InputMask care = 0, value = 0;
+        for (byte i = 0; i < count; i++) {
+            const Rule& r = rules[i];
+            if (!hasTerms(r)) continue;
+            byte term = 0;
+            for (byte k = r.termStart(); k + TERM_SIZE <= r.header.length; k += TERM_SIZE, term++) {
+                if ((r.sharedAt >> term) & 1) continue;
+                InputMask c = r.mask(k), v = r.mask(k + MASK_SIZE);
+                byte users = 1;
+                for (byte j = i + 1; j < count; j++) users += findTerm(rules[j], c, v) >= 0;
+                if (users > best) {
+                    best = users;
+                    care = c;
+                    value = v;
+                }
+            }
+        }
+        if (best < 2) break;
+        
+        byte t = sharedCount++;
+        sharedCare[t] = care;
+        sharedValue[t] = value;
+        for (byte i = 0; i < count; i++) {
+            int term = findTerm(rules[i], care, value);
+            if (term < 0) continue;
+            rules[i].sharedTerms |= (byte)(1 << t);
+            rules[i].sharedAt |= (byte)(1 << term);
+        }
+        rep.termsShared++;
+        if (out) {
+            out->print("OPT share "); out->print(t); out->print(" x"); out->println(best);
+        }
+    }
+    
+    checks = 0;
+    tests = 0;
+    for (byte i = 0; i < count; i++) addCost(rules[i], checks, tests);
+    
+    // Общий терм сравнивается на каждом снимке, где проверяется хотя бы
+    // одно его правило
+    for (byte t = 0; t < sharedCount; t++) {
+        InputMask reads = 0;
+        for (byte i = 0; i < count; i++) {
+            if ((rules[i].sharedTerms >> t) & 1) reads |= rules[i].inputMask();
+        }
+        tests += (unsigned long)countBits(reads) << 8;
+    }
+    rep.checksAfter = saturate(checks);
+    rep.testsAfter = saturate(tests >> 8);
+    
+    if (out) {
+        out->print("OPT rules "); out->print(rep.rulesBefore); out->print(" -> "); out->print(rep.rulesAfter);
+        out->print(" checks "); out->print(rep.checksBefore); out->print(" -> "); out->print(rep.checksAfter);
+        out->print(" tests "); out->print(rep.testsBefore); out->print(" -> "); out->print(rep.testsAfter);
+        out->print(" shared "); out->print(rep.termsShared);
+        out->print(" arena -"); out->println(rep.arenaFreed);
+    }
+    if (report) *report = rep;
+    return true;
+#else
+    (void)out;
+    (void)report;
+    return false;
+#endif
+}
+
+#if EGLANG_OPTIMIZE
+
+// Правила без drop подключаются заново в прежнем порядке. Образы в арене
+// лежат по возрастанию адреса, поэтому сжатие сдвигает их только назад.
+// releaseOutputs - свойство выхода, а не правила: удаленное правило HIGH
+// продолжает отпускать свой выход
+void EgLangController::rebuild(RuleMask drop) {
+    const RuleImage* images[MAX_RULES];
+    RuleMask flash = 0;
+    byte n = 0;
+    for (byte i = 0; i < count; i++) {
+        if ((drop >> i) & 1) continue;
+        images[n] = rules[i].image;
+        if (rules[i].inFlash) flash |= (RuleMask)1 << n;
+        n++;
+    }
+    
+    OutputMask release = releaseOutputs;
+    clearRules();
+    for (byte k = 0; k < n; k++) {
+        const RuleImage* image = images[k];
+        bool inFlash = (flash >> k) & 1;
+#if EGLANG_ARENA_SIZE > 0
+        if (!inFlash && (const byte*)image >= arena && (const byte*)image < arena + EGLANG_ARENA_SIZE) {
+            RuleImage* record = (RuleImage*)&arena[arenaUsed];
+            byte size = image->size();
+            memmove(record, image, size);
+            arenaUsed += size;
+            image = record;
+        }
+#endif
+        attach(image, inFlash);
+    }
+    releaseOutputs |= release;
+}
+
+// Общие термы terms на снимке snapshot. Итог каждого терма запоминается
+// до смены снимка: в цикле его сравнивает только первое проверенное правило
+bool EgLangController::sharedTermMet(byte terms, InputMask snapshot) {
+    if (snapshot != sharedSnapshot) {
+        sharedSnapshot = snapshot;
+        sharedKnown = 0;
+        sharedMet = 0;
+    }
+    if (terms & sharedMet) return true;
+    byte unknown = terms & ~sharedKnown;
+    for (byte t = 0; unknown; t++, unknown >>= 1) {
+        if (!(unknown & 1)) continue;
+        byte bit = (byte)(1 << t);
+        sharedKnown |= bit;
+        if ((snapshot & sharedCare[t]) == sharedValue[t]) {
+            sharedMet |= bit;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef EGLANG_OPTIMIZE_H
+#define EGLANG_OPTIMIZE_H
+
+#include <Arduino.h>
+
+// Анализ и оптимизация набора правил после загрузки (флагом -D для всего проекта):
+// 0 - выключены, optimize() ничего не делает и возвращает false
+// 1 - optimize() удаляет правила, которые не меняют выходы, переставляет
+//     термы условий в SRAM, сводит повторяющиеся термы в общую таблицу
+//     и печатает найденное (около 2 КБ flash)
+#ifndef EGLANG_OPTIMIZE
+#define EGLANG_OPTIMIZE 0
+#endif
+
+// Общих термов в таблице optimize() (до 8): терм, который встречается в
+// условиях нескольких правил, сравнивается один раз на снимок входов.
+// SRAM: 2 маски на терм и 2 байта на правило
+#ifndef EGLANG_SHARED_TERMS
+#define EGLANG_SHARED_TERMS 8
+#endif
+
+// Итог optimize(). Оценка работы - на проход, в котором каждый вход
+// меняется один раз: проверок правил (по индексу зависимостей) и
+// ожидаемых сравнений термов (входы равновероятны, терм с k входами
+// выполнен с вероятностью 2^-k, проверка останавливается на первом)
+struct EgOptimizeReport {
+    byte rulesBefore;
+    byte rulesAfter;
+    byte duplicates;             // Удалено повторов правила
+    byte shadowed;               // Удалено правил, которые никогда не выигрывают арбитраж
+    byte never;                  // Удалено условий, которые не выполняются никогда
+    byte conflicts;              // Пар правил, задающих выходу разное при одном снимке
+    byte termsReordered;         // Правил, где общие термы переставлены вперед
+    byte termsShared;            // Термов в общей таблице (в условиях хотя бы двух правил)
+    word checksBefore;
+    word checksAfter;
+    word testsBefore;
+    word testsAfter;
+    word arenaFreed;             // Байт арены, освобожденных удалением правил
+};
+
+#endif
@@ -0,0 +1,267 @@
+#ifndef EGLANG_PINS_H
+#define EGLANG_PINS_H
+
+#include <Arduino.h>
+
+// Профиль платы: списки пинов для PROGMEM таблиц и признаков пинов и их число.
+// По умолчанию выбирается по процессору; -DEGLANG_BOARD=... для всего проекта.
+// Свой набор: EGLANG_INPUT_PINS, EGLANG_OUTPUT_PINS, INPUT_COUNT и OUTPUT_COUNT
+// флагами -D (до 64 входов и 64 выходов, номера пинов 2-99)
+#define EGLANG_BOARD_CUSTOM 0
+#define EGLANG_BOARD_UNO    1             // Uno, Nano, Pro Mini: 6 входов, 6 выходов
+#define EGLANG_BOARD_MEGA   2             // Mega 2560: 32 входа, 28 выходов
+#define EGLANG_BOARD_ESP32  3             // ESP32: 8 входов, 8 выходов
+
+#ifndef EGLANG_BOARD
+#if defined(EGLANG_INPUT_PINS)
+#define EGLANG_BOARD EGLANG_BOARD_CUSTOM
+#elif defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+#define EGLANG_BOARD EGLANG_BOARD_MEGA
+#elif defined(ESP32)
+#define EGLANG_BOARD EGLANG_BOARD_ESP32
+#else
+#define EGLANG_BOARD EGLANG_BOARD_UNO
+#endif
+#endif
+
+#if EGLANG_BOARD == EGLANG_BOARD_UNO
+#define EGLANG_INPUT_PINS  3, 5, 7, 9, 11, 13
+#define EGLANG_OUTPUT_PINS 2, 4, 6, 8, 10, 12
+#define INPUT_COUNT 6
+#define OUTPUT_COUNT 6
+#define EGLANG_ANALOG_PINS 14, 15, 16, 17, 18, 19  // A0-A5
+#define ANALOG_COUNT 6
+#define EGLANG_PWM_OUTPUTS 0x14                    // 6, 10 (таймеры 0 и 1)
+#elif EGLANG_BOARD == EGLANG_BOARD_MEGA
+// Входы 22-37 и A0-A15, выходы 2-13 и 38-53; 0-1 и 14-21 (Serial1-3, I2C) свободны
+#define EGLANG_INPUT_PINS  22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, \
+                           54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69
+#define EGLANG_OUTPUT_PINS 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, \
+                           38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53
+#define INPUT_COUNT 32
+#define OUTPUT_COUNT 28
+#define ANALOG_COUNT 0                             // A0-A15 заняты входами
+#define EGLANG_PWM_OUTPUTS 0x1C0FFFUL              // 2-13, 44-46
+#elif EGLANG_BOARD == EGLANG_BOARD_ESP32
+// GPIO с подтяжкой; 0-1 (загрузка, UART) и 34-39 (без подтяжки) не заняты
+#define EGLANG_INPUT_PINS  13, 14, 16, 17, 18, 19, 21, 22
+#define EGLANG_OUTPUT_PINS 4, 5, 23, 25, 26, 27, 32, 33
+#define INPUT_COUNT 8
+#define OUTPUT_COUNT 8
+#define EGLANG_ANALOG_PINS 36, 39, 34, 35          // ADC1: работает и при Wi-Fi
+#define ANALOG_COUNT 4
+#define EGLANG_PWM_OUTPUTS 0xFF                    // LEDC на всех выходах
+#elif !defined(EGLANG_INPUT_PINS) || !defined(EGLANG_OUTPUT_PINS) || !defined(INPUT_COUNT) || !defined(OUTPUT_COUNT)
+#error "EGLANG_BOARD_CUSTOM needs EGLANG_INPUT_PINS, EGLANG_OUTPUT_PINS, INPUT_COUNT and OUTPUT_COUNT"
+#endif
+static_assert(INPUT_COUNT >= 1 && INPUT_COUNT <= 64 && OUTPUT_COUNT >= 1 && OUTPUT_COUNT <= 64,
+              "pin masks are at most 64 bits wide");
+
+// Аналоговые каналы "A0", "A1"... - пины EGLANG_ANALOG_PINS по порядку, и
+// выходы с ШИМ (бит i - outputs[i]) для EGLANG_ANALOG. У своего профиля
+// по умолчанию нет ни тех, ни других
+#ifndef ANALOG_COUNT
+#define ANALOG_COUNT 0
+#endif
+#ifndef EGLANG_PWM_OUTPUTS
+#define EGLANG_PWM_OUTPUTS 0
+#endif
+static_assert(ANALOG_COUNT <= 8, "analog channels are a byte mask");
+
+// Маски пинов: бит i - inputs[i] (снимок входов, термы условий) или
+// outputs[i] (кадр и состояние выходов). Ширина - по числу пинов профиля,
+// чтобы снимок, условия и запись выходов шли словами, а на Uno - байтами
+#if INPUT_COUNT <= 8
+typedef byte InputMask;
+#define MASK_SIZE 1
+#elif INPUT_COUNT <= 16
+typedef uint16_t InputMask;
+#define MASK_SIZE 2
+#elif INPUT_COUNT <= 32
+typedef uint32_t InputMask;
+#define MASK_SIZE 4
+#else
+typedef uint64_t InputMask;
+#define MASK_SIZE 8
+#endif
+static_assert(sizeof(InputMask) == MASK_SIZE, "MASK_SIZE is the byte size of InputMask");
+
+#if OUTPUT_COUNT <= 8
+typedef byte OutputMask;
+#elif OUTPUT_COUNT <= 16
+typedef uint16_t OutputMask;
+#elif OUTPUT_COUNT <= 32
+typedef uint32_t OutputMask;
+#else
+typedef uint64_t OutputMask;
+#endif
+
+// Конфигурация пинов (в PROGMEM для экономии SRAM)
+extern const byte inputs[] PROGMEM;
+extern const byte outputs[] PROGMEM;
+
+// Списки пинов только для константных выражений (в память не попадают):
+// порты ввода-вывода и компилятор правил RF()
+constexpr byte egInputPins[] = { EGLANG_INPUT_PINS };
+constexpr byte egOutputPins[] = { EGLANG_OUTPUT_PINS };
+static_assert(sizeof(egInputPins) == INPUT_COUNT, "EGLANG_INPUT_PINS does not match INPUT_COUNT");
+static_assert(sizeof(egOutputPins) == OUTPUT_COUNT, "EGLANG_OUTPUT_PINS does not match OUTPUT_COUNT");
+
+// Прямой доступ к регистрам портов, если для платы есть признаки пинов.
+// 0 - всегда через pinMode()/digitalRead()/digitalWrite()
+#ifndef EGLANG_FAST_IO
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || \
+    defined(__AVR_ATmega168__) || defined(__AVR_ATmega168A__)
+#define EGLANG_FAST_IO 1
+#else
+#define EGLANG_FAST_IO 0
+#endif
+#endif
+
+// Входы по прерываниям PCINT и сон между событиями (1 - включено).
+// Обработчики PCINT0..2 занимает библиотека, поэтому флаг - для всего проекта
+#ifndef EGLANG_PCINT
+#define EGLANG_PCINT 0
+#endif
+static_assert(!EGLANG_PCINT || EGLANG_FAST_IO, "EGLANG_PCINT needs EGLANG_FAST_IO (ATmega328P/168)");
+
+#if EGLANG_FAST_IO
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// Признаки пинов ATmega328P/168 (Uno, Nano, Pro Mini):
+// 0-7 - порт D, 8-13 - порт B, 14-19 (A0-A5) - порт C
+enum : byte { EG_PORT_B = 0, EG_PORT_C = 1, EG_PORT_D = 2, EG_PORT_COUNT = 3 };
+
+constexpr byte egPinPort(byte pin) {
+    return pin < 8 ? EG_PORT_D : (pin < 14 ? EG_PORT_B : EG_PORT_C);
+}
+
+constexpr byte egPinMask(byte pin) {
+    return (byte)(1 << (pin < 8 ? pin : (pin < 14 ? pin - 8 : pin - 14)));
+}
+
+// Биты порта, занятые пинами списка
+template <byte N>
+constexpr byte egPortBits(const byte (&pins)[N], byte port, byte i = 0) {
+    return i >= N ? 0 : (byte)((egPinPort(pins[i]) == port ? egPinMask(pins[i]) : 0) |
+                               egPortBits(pins, port, i + 1));
+}
+
+// Сборка снимка входов из значений портов (развертывается при компиляции)
+template <byte I>
+struct EgInputBits {
+    static inline InputMask gather(const byte* ports) {
+        constexpr byte pin = egInputPins[I - 1];
+        return (InputMask)(EgInputBits<I - 1>::gather(ports) |
+                           ((ports[egPinPort(pin)] & egPinMask(pin)) ? 0 : ((InputMask)1 << (I - 1))));
+    }
+};
+
+template <>
+struct EgInputBits<0> {
+    static inline InputMask gather(const byte*) { return 0; }
+};
+
+// Раскладка маски выходов по портам: set - в HIGH, clr - в LOW
+template <byte I>
+struct EgOutputBits {
+    static inline void scatter(OutputMask mask, OutputMask values, byte* set, byte* clr) {
+        EgOutputBits<I - 1>::scatter(mask, values, set, clr);
+        constexpr byte pin = egOutputPins[I - 1];
+        if ((mask >> (I - 1)) & 1) {
+            if ((values >> (I - 1)) & 1) set[egPinPort(pin)] |= egPinMask(pin);
+            else clr[egPinPort(pin)] |= egPinMask(pin);
+        }
+    }
+};
+
+template <>
+struct EgOutputBits<0> {
+    static inline void scatter(OutputMask, OutputMask, byte*, byte*) { }
+};
+
+// Снимок входов: бит i = inputs[i] в LOW. По одному чтению на порт
+inline InputMask egReadInputs() {
+    constexpr byte usesB = egPortBits(egInputPins, EG_PORT_B);
+    constexpr byte usesC = egPortBits(egInputPins, EG_PORT_C);
+    constexpr byte usesD = egPortBits(egInputPins, EG_PORT_D);
+    
+    byte ports[EG_PORT_COUNT];
+    ports[EG_PORT_B] = usesB ? PINB : 0;
+    ports[EG_PORT_C] = usesC ? PINC : 0;
+    ports[EG_PORT_D] = usesD ? PIND : 0;
+    return EgInputBits<INPUT_COUNT>::gather(ports);
+}
+
+// Запись выходов: для битов mask перевести outputs[i] в OUTPUT
+// и установить значение из values. Одна маскированная запись на порт
+inline void egWriteOutputs(OutputMask mask, OutputMask values) {
+    constexpr byte usesB = egPortBits(egOutputPins, EG_PORT_B);
+    constexpr byte usesC = egPortBits(egOutputPins, EG_PORT_C);
+    constexpr byte usesD = egPortBits(egOutputPins, EG_PORT_D);
+    
+    byte set[EG_PORT_COUNT] = {0, 0, 0};
+    byte clr[EG_PORT_COUNT] = {0, 0, 0};
+    EgOutputBits<OUTPUT_COUNT>::scatter(mask, values, set, clr);
+    
+    byte sreg = SREG;
+    cli();
+    if (usesB) {
+        DDRB |= set[EG_PORT_B] | clr[EG_PORT_B];
+        PORTB = (PORTB & ~clr[EG_PORT_B]) | set[EG_PORT_B];
+    }
+    if (usesC) {
+        DDRC |= set[EG_PORT_C] | clr[EG_PORT_C];
+        PORTC = (PORTC & ~clr[EG_PORT_C]) | set[EG_PORT_C];
+    }
+    if (usesD) {
+        DDRD |= set[EG_PORT_D] | clr[EG_PORT_D];
+        PORTD = (PORTD & ~clr[EG_PORT_D]) | set[EG_PORT_D];
+    }
+    SREG = sreg;
+}
+
+// Прерывания по изменению входов: PCMSK0 - порт B, PCMSK1 - порт C,
+// PCMSK2 - порт D. Включаются только группы портов, где есть входы
+inline void egArmPinChange() {
+    constexpr byte usesB = egPortBits(egInputPins, EG_PORT_B);
+    constexpr byte usesC = egPortBits(egInputPins, EG_PORT_C);
+    constexpr byte usesD = egPortBits(egInputPins, EG_PORT_D);
+    constexpr byte groups = (usesB ? _BV(PCIE0) : 0) | (usesC ? _BV(PCIE1) : 0) | (usesD ? _BV(PCIE2) : 0);
+    
+    byte sreg = SREG;
+    cli();
+    PCMSK0 |= usesB;
+    PCMSK1 |= usesC;
+    PCMSK2 |= usesD;
+    PCIFR = groups;              // Старые флаги не в счет
+    PCICR |= groups;
+    SREG = sreg;
+}
+
+#else
+
+// Переносимый вариант через Arduino API
+inline InputMask egReadInputs() {
+    InputMask snapshot = 0;
+    for (byte i = 0; i < INPUT_COUNT; i++) {
+        if (digitalRead(pgm_read_byte(&inputs[i])) == LOW) snapshot |= (InputMask)1 << i;
+    }
+    return snapshot;
+}
+
+inline void egWriteOutputs(OutputMask mask, OutputMask values) {
+    for (byte i = 0; i < OUTPUT_COUNT; i++) {
+        if ((mask >> i) & 1) {
+            byte pin = pgm_read_byte(&outputs[i]);
+            pinMode(pin, OUTPUT);
+            digitalWrite(pin, (values >> i) & 1);
+        }
+    }
+}
+
+#endif
+
+#endif
@@ -0,0 +1,69 @@
+#include "EgLang.h"
+
+#if EGLANG_STATS
+
+void EgStats::scanEnd() {
+    unsigned long us = micros() - scanStartUs;
+    if (scanCount == 0 || us < scanMinUs) scanMinUs = us;
+    if (us > scanMaxUs) scanMaxUs = us;
+    // Счетчик и сумма останавливаются вместе, чтобы среднее оставалось верным
+    if (scanCount < 0xFFFFFFFFUL && scanTotalUs <= 0xFFFFFFFFUL - us) {
+        scanCount++;
+        scanTotalUs += us;
+    }
+}
+
+void EgStats::jitter(unsigned long us) {
+    byte k = 0;
+    for (unsigned long limit = EGLANG_JITTER_BASE_US; us >= limit && k < EGLANG_JITTER_BUCKETS - 1; limit <<= 1) {
+        k++;
+    }
+    if (jitterHist[k] < 0xFFFF) jitterHist[k]++;
+}
+
+void EgStats::ruleChecked(byte rule, unsigned long us) {
+    if (ruleChecks[rule] == 0xFFFF || ruleUs[rule] > 0xFFFFFFFFUL - us) return;
+    ruleChecks[rule]++;
+    ruleUs[rule] += us;
+}
+
+void EgStats::clear() {
+    memset(this, 0, sizeof(*this));
+}
+
+// SCAN n=.. min=.. avg=.. max=.. us
+// JITTER <64:n <128:n ... >=4096:n
+// RULE i n=проверок fire=срабатываний avg=мкс total=мкс (только проверенные)
+// WRITES n
+void EgStats::dump(Print& out, byte rules) const {
+    out.print("SCAN n="); out.print(scanCount);
+    out.print(" min="); out.print(scanMinUs);
+    out.print(" avg="); out.print(scanAvgUs());
+    out.print(" max="); out.print(scanMaxUs);
+    out.println(" us");
+    
+    out.print("JITTER");
+    unsigned long limit = EGLANG_JITTER_BASE_US;
+    for (byte k = 0; k < EGLANG_JITTER_BUCKETS; k++, limit <<= 1) {
+        if (k < EGLANG_JITTER_BUCKETS - 1) {
+            out.print(" <"); out.print(limit);
+        } else {
+            out.print(" >="); out.print(limit >> 1);
+        }
+        out.print(':'); out.print(jitterHist[k]);
+    }
+    out.println();
+    
+    for (byte i = 0; i < rules && i < MAX_RULES; i++) {
+        if (!ruleChecks[i] && !ruleFires[i]) continue;
+        out.print("RULE "); out.print(i);
+        out.print(" n="); out.print(ruleChecks[i]);
+        out.print(" fire="); out.print(ruleFires[i]);
+        out.print(" avg="); out.print(ruleChecks[i] ? ruleUs[i] / ruleChecks[i] : 0);
+        out.print(" total="); out.println(ruleUs[i]);
+    }
+    
+    out.print("WRITES "); out.println(outputWrites);
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef EGLANG_STATS_H
+#define EGLANG_STATS_H
+
+#include <Arduino.h>
+
+// Счетчики производительности (флагом -D для всего проекта):
+// 0 - выключены полностью, код и счетчики не компилируются
+// 1 - время цикла, гистограмма дрожания, время и срабатывания каждого правила,
+//     число записей в выходы
+#ifndef EGLANG_STATS
+#define EGLANG_STATS 0
+#endif
+
+// Гистограмма дрожания poll(): корзина k - отклонение периода по модулю
+// меньше EGLANG_JITTER_BASE_US << k, последняя - все остальное
+#ifndef EGLANG_JITTER_BUCKETS
+#define EGLANG_JITTER_BUCKETS 8
+#endif
+#ifndef EGLANG_JITTER_BASE_US
+#define EGLANG_JITTER_BASE_US 64
+#endif
+
+#if EGLANG_STATS
+
+// Счетчики насыщаются, а не переполняются; суммы времени останавливаются
+// вместе со своими счетчиками проверок. Время - по micros(), поэтому
+// на AVR разрешение 4 мкс: время правила осмысленно как сумма за много проверок
+class EgStats {
+public:
+    void scanBegin() { scanStartUs = micros(); }
+    void scanEnd();
+    void jitter(unsigned long us);               // Отклонение периода poll() по модулю
+    void ruleChecked(byte rule, unsigned long us);
+    void ruleFired(byte rule) { if (ruleFires[rule] < 0xFFFF) ruleFires[rule]++; }
+    void outputWritten() { if (outputWrites < 0xFFFFFFFFUL) outputWrites++; }
+    
+    unsigned long scanAvgUs() const { return scanCount ? scanTotalUs / scanCount : 0; }
+    void dump(Print& out, byte rules) const;     // Компактный текстовый отчет
+    void clear();
+    
+    unsigned long scanCount;                     // Циклов run() с правилами
+    unsigned long scanMinUs;
+    unsigned long scanMaxUs;
+    unsigned long scanTotalUs;
+    word jitterHist[EGLANG_JITTER_BUCKETS];
+    
+    unsigned long ruleUs[MAX_RULES];             // Суммарное время check()
+    word ruleChecks[MAX_RULES];                  // Вызовов check()
+    word ruleFires[MAX_RULES];                   // Запросов действия / захватов выхода
+    unsigned long outputWrites;                  // Записей в выходы
+    
+private:
+    unsigned long scanStartUs;
+};
+
+#define EGLANG_STATS_FIRE(ctrl, rule) do { (ctrl).stats.ruleFired(rule); } while (0)
+#define EGLANG_STATS_WRITE(ctrl) do { (ctrl).stats.outputWritten(); } while (0)
+
+#else
+
+#define EGLANG_STATS_FIRE(ctrl, rule) do { } while (0)
+#define EGLANG_STATS_WRITE(ctrl) do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,117 @@
+#include "EgLangTrace.h"
+
+#if EGLANG_TRACE_LEVEL > 0
+
+// Самая длинная строка или кадр события, для неблокирующего вывода в Serial.
+// Текстовая - SCAN с наибольшими числами, проверяется в print()
+#if EGLANG_TRACE_BINARY
+#define TRACE_LINE_MAX TRACE_FRAME_SIZE
+#else
+#define TRACE_LINE_MAX 32
+#endif
+#ifdef SERIAL_TX_BUFFER_SIZE
+static_assert(TRACE_LINE_MAX < SERIAL_TX_BUFFER_SIZE, "trace line does not fit the Serial TX buffer");
+#endif
+
+void EgTrace::record(byte type, byte a, word b) {
+    // После потерь нужно место и под отметку TRACE_DROPPED
+    byte room = (EGLANG_TRACE_SIZE - 1) - size();
+    if (room < (dropped ? 2 : 1)) {
+        if (dropped < 0xFF) dropped++;
+        return;
+    }
+    
+    if (dropped) {
+        push(TRACE_DROPPED, dropped, 0);
+        dropped = 0;
+    }
+    push(type, a, b);
+}
+
+void EgTrace::push(byte type, byte a, word b) {
+    TraceEvent& e = events[head];
+    e.type = type;
+    e.a = a;
+    e.b = b;
+#if EGLANG_TRACE_BINARY
+    e.time = (word)millis();
+#endif
+    head = (head + 1) & (EGLANG_TRACE_SIZE - 1);
+}
+
+void EgTrace::clear() {
+    head = tail = dropped = 0;
+}
+
+#if EGLANG_TRACE_BINARY
+
+void EgTrace::print(Print& out, const TraceEvent& e) {
+    byte frame[TRACE_FRAME_SIZE] = {
+        TRACE_SYNC, e.type, e.a, (byte)e.b, (byte)(e.b >> 8), (byte)e.time, (byte)(e.time >> 8), 0
+    };
+    for (byte i = 1; i < TRACE_FRAME_SIZE - 1; i++) frame[TRACE_FRAME_SIZE - 1] += frame[i];
+    out.write(frame, TRACE_FRAME_SIZE);
+}
+
+#else
+
+void EgTrace::print(Print& out, const TraceEvent& e) {
+    switch (e.type) {
+        case TRACE_PIN_CHANGE:
+            out.print("CHANGE Pin "); out.print(e.a);
+            out.print(" -> "); out.println(e.b);
+            break;
+        case TRACE_LOOP_ENTER:
+            out.print("LOOP "); out.print(e.a);
+            out.print(" enter pin "); out.println(e.b);
+            break;
+        case TRACE_LOOP_EXIT:
+            out.print("LOOP "); out.print(e.a);
+            out.print(" exit pin "); out.println(e.b);
+            break;
+        case TRACE_RULE_FIRE:
+            out.print("RULE "); out.print(e.a);
+            out.print(" -> pin "); out.println(e.b);
+            break;
+        case TRACE_SHUTDOWN:
+            out.println("EgLang shutdown complete");
+            break;
+        case TRACE_SCAN_STATS:
+            static_assert(sizeof("SCAN overruns 255 jitter 65535\r\n") - 1 <= TRACE_LINE_MAX,
+                          "TRACE_LINE_MAX is shorter than the longest trace line");
+            out.print("SCAN overruns "); out.print(e.a);
+            out.print(" jitter "); out.println(e.b);
+            break;
+        case TRACE_DROPPED:
+            out.print("TRACE dropped "); out.println(e.a);
+            break;
+    }
+}
+
+#endif
+
+byte EgTrace::drain(Print& out, byte maxEvents) {
+    // Потерянные события новее всех в очереди - отметка встает в конец
+    if (dropped && size() < EGLANG_TRACE_SIZE - 1) {
+        push(TRACE_DROPPED, dropped, 0);
+        dropped = 0;
+    }
+    
+    byte n = 0;
+    while (tail != head && n < maxEvents) {
+        print(out, events[tail]);
+        tail = (tail + 1) & (EGLANG_TRACE_SIZE - 1);
+        n++;
+    }
+    return n;
+}
+
+byte EgTrace::drainSerial() {
+    byte n = 0;
+    while ((tail != head || dropped) && Serial.availableForWrite() >= TRACE_LINE_MAX) {
+        n += drain(Serial, 1);
+    }
+    return n;
+}
+
+#endif
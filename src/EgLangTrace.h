@@ -0,0 +1,97 @@
+#ifndef EGLANG_TRACE_H
+#define EGLANG_TRACE_H
+
+#include <Arduino.h>
+
+// Уровень трассировки (флагом -D для всего проекта или правкой этого файла):
+// 0 - выключена полностью, код и буфер не компилируются
+// 1 - изменения выходов, вход/выход из циклов, shutdown
+// 2 - дополнительно срабатывания правил
+#ifndef EGLANG_TRACE_LEVEL
+#define EGLANG_TRACE_LEVEL 1
+#endif
+
+// Размер кольцевого буфера в событиях (степень двойки)
+#ifndef EGLANG_TRACE_SIZE
+#define EGLANG_TRACE_SIZE 16
+#endif
+
+// Скорость Serial для вывода трассировки
+#ifndef EGLANG_SERIAL_BAUD
+#define EGLANG_SERIAL_BAUD 9600
+#endif
+
+// Формат вывода: 0 - текст, 1 - двоичные кадры с меткой времени
+// (разбирает extras/host/tools/eglang_telemetry)
+#ifndef EGLANG_TRACE_BINARY
+#define EGLANG_TRACE_BINARY 0
+#endif
+
+// Событие статистики планировщика каждые N циклов poll() (0 - не писать)
+#ifndef EGLANG_TRACE_STATS_SCANS
+#define EGLANG_TRACE_STATS_SCANS 0
+#endif
+
+// Типы событий
+enum : byte {
+    TRACE_PIN_CHANGE = 1,            // a = пин, b = состояние
+    TRACE_LOOP_ENTER,                // a = правило, b = пин цикла
+    TRACE_LOOP_EXIT,                 // a = правило, b = пин цикла
+    TRACE_RULE_FIRE,                 // a = правило, b = пин действия
+    TRACE_SHUTDOWN,
+    TRACE_SCAN_STATS,                // a = опоздания (до 255), b = макс. дрожание, мкс (до 65535)
+    TRACE_DROPPED                    // a = сколько событий потеряно на этом месте потока
+};
+
+// Компактное событие (4 байта, в двоичном формате 6)
+struct TraceEvent {
+    byte type;
+    byte a;
+    word b;
+#if EGLANG_TRACE_BINARY
+    word time;                       // Младшие 16 бит millis()
+#endif
+};
+
+// Двоичный кадр: TRACE_SYNC тип a b(2) время(2) сумма - 8 байт, числа
+// младшим байтом вперед, сумма - байты 1..6 по модулю 256. Приемник ищет
+// TRACE_SYNC и при неверной сумме сдвигается на байт
+enum : byte { TRACE_SYNC = 0xA5, TRACE_FRAME_SIZE = 8 };
+
+#if EGLANG_TRACE_LEVEL > 0
+
+static_assert((EGLANG_TRACE_SIZE & (EGLANG_TRACE_SIZE - 1)) == 0,
+              "EGLANG_TRACE_SIZE must be a power of two");
+
+// Кольцевой буфер событий. record() не блокирует: при переполнении
+// новое событие отбрасывается и учитывается в dropped, а когда место
+// появится, в поток на место потери встает TRACE_DROPPED с их числом
+class EgTrace {
+public:
+    void record(byte type, byte a, word b);
+    byte drain(Print& out, byte maxEvents); // Выводит до maxEvents событий текстом
+    byte drainSerial();                     // Выводит, пока есть место в TX буфере Serial
+    void clear();
+    byte size() const { return (byte)(head - tail) & (EGLANG_TRACE_SIZE - 1); }
+    
+private:
+    TraceEvent events[EGLANG_TRACE_SIZE];
+    byte head;                   // Индекс записи
+    byte tail;                   // Индекс чтения
+    byte dropped;                // Отброшено с последнего вывода
+    
+    void push(byte type, byte a, word b);
+    void print(Print& out, const TraceEvent& e);
+};
+
+// Запись события, если уровень включен при компиляции
+#define EGLANG_TRACE(ctrl, level, type, a, b) \
+    do { if ((level) <= EGLANG_TRACE_LEVEL) (ctrl).trace.record((type), (a), (b)); } while (0)
+
+#else
+
+#define EGLANG_TRACE(ctrl, level, type, a, b) do { } while (0)
+
+#endif
+
+#endif
@@ -10,7 +10,7 @@
   Примеры правил:
   - "2,1" - включить пин 2
   - "?3,0!4,1" - если пин 3 в LOW, то включить пин 4
-  - "[3:8,1;8,0]" - пока пин 3 нажат, мигать пином 8
+  - "[3:8,1@200;8,0@300]" - пока пин 3 нажат, мигать пином 8
 */
 
 AUTO_START
@@ -23,7 +23,7 @@ AUTO_START
   R("?5,0!8,1");   // Если кнопка на пине 5 нажата, включить пин 8
   
   // Циклы
-  R("[7:10,1;10,0]"); // Пока кнопка на пине 7 нажата, мигать пином 10
+  R("[7:10,1@200;10,0@300]"); // Пока кнопка на пине 7 нажата, мигать пином 10
   
   // AND условие
   R("?3,0&5,0!12,1"); // Если ОБЕ кнопки на пинах 3 И 5 нажаты, включить пин 12